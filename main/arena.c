@@ -0,0 +1,44 @@
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
+#include "arena.h"
+
+/* Exported functions --------------------------------------------------------*/
+void arena_init(arena_t* arena, void* buf, size_t size)
+{
+    arena->base = buf;
+    arena->size = size;
+    arena->used = 0;
+}
+
+/**
+ * @brief Take size bytes from the arena. The returned pointer is aligned
+ * to ARENA_ALIGN, so it can hold any struct.
+ *
+ * @retval NULL if the arena is exhausted
+ */
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    size_t needed = ARENA_SIZEOF(size);
+
+    if (needed > arena->size - arena->used)
+        return NULL;
+
+    void* ptr = arena->base + arena->used;
+    arena->used += needed;
+    return ptr;
+}
+
+/**
+ * @brief Copy len bytes of str into the arena, adding the null terminator.
+ *
+ */
+char* arena_strndup(arena_t* arena, const char* str, size_t len)
+{
+    char* dup = arena_alloc(arena, len + 1);
+    if (dup) {
+        memcpy(dup, str, len);
+        dup[len] = '\0';
+    }
+    return dup;
+}
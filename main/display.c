@@ -1,13 +1,21 @@
 /* Includes ------------------------------------------------------------------*/
+#include <stdatomic.h>
+
 #include "esp_log.h"
 
 #include "display.h"
+#include "display_flush.h"
 #include "handler_callbacks.h"
+#include "input.h"
+#include "marquee.h"
+#include "overlay.h"
+#include "render_sched.h"
 #include "selection_list.h"
 #include "spiffs_wifi.h"
 #include "spotifyclient.h"
 #include "strlib.h"
 #include "u8g2_esp32_hal.h"
+#include "unifont.h"
 
 /* Private macro -------------------------------------------------------------*/
 #define MENU_FONT       u8g2_font_6x12_te
@@ -18,50 +26,252 @@
 #define DRAW_STR(x, y, font, str)     \
     u8g2_SetFont(&s_u8g2, font);      \
     u8g2_DrawStr(&s_u8g2, x, y, str); \
-    u8g2_SendBuffer(&s_u8g2)
+    display_flush(&s_u8g2)
 
 #define DRAW_STR_CLR(x, y, font, str) \
     u8g2_ClearBuffer(&s_u8g2);        \
     DRAW_STR(x, y, font, str)
 
-#define INIT_MSG_INFO(msg)                           \
-    {                                                \
-        u8g2_GetUTF8Width(&s_u8g2, msg), 0, false, 0 \
-    }
+#define MS_TO_TICKS_CEIL(ms) pdMS_TO_TICKS((ms) + portTICK_PERIOD_MS - 1)
+
+
+/* Scrolling text is pre-rendered, wider text is cut */
+#define REGION_MAX_WIDTH 1024
+#define DEVICE_MAX_WIDTH 512
+#define TRACK_TEXT_MAX   256 /* longest text of a region */
+
+#define TOAST_MS          3000
+#define VOLUME_OVERLAY_MS 2000
 
 #define BAR_WIDTH   3
 #define BAR_PADDING 1
 
+#define VOLUME_STEP        3
+#define VOLUME_DEBOUNCE_MS 400
+
+#define MENU_MAX_ITEMS 5
+
+#define CLIENT_EVENTS_LEN 8
+
+#define TRANSFER_TIMEOUT_MS 15000 /* longest wait for a playback transfer */
+#define STATE_TIMEOUT_MS    20000 /* longest wait for the first player state */
+
+#define DISPLAY_TASK_STACK 4096
+
+/* Lists are prefetched when the cursor rests on the menu item that opens them */
+#define PREFETCH_REST_MS 300
+#define PLAYLISTS_TTL_MS 30000
+#define DEVICES_TTL_MS   5000 /* the page fetches again after 10 s idle */
+
 /* Private types -------------------------------------------------------------*/
 
-// stores the state of the message scrolling on display
+// what ended wait_event()
+typedef enum {
+    WAKE_TIMEOUT,
+    WAKE_INPUT,
+    WAKE_CLIENT,
+} wake_t;
+
+// regions of the now playing page, top to bottom
+enum {
+    REGION_DEVICE,
+    REGION_TITLE,
+    REGION_ARTISTS,
+    REGION_ALBUM,
+    NOW_PLAYING_REGIONS,
+};
+
+typedef enum {
+    PAGE_MAIN_MENU,
+    PAGE_SYSTEM_MENU,
+    PAGE_TRACK_MENU,
+    PAGE_NOW_PLAYING,
+    PAGE_PLAYLISTS,
+    PAGE_DEVICES,
+    PAGE_VOLUME,
+    PAGE_DELETE_WIFI,
+    PAGE_RESTART,
+    PAGE_TEST_MESSAGE,
+    PAGE_COUNT,
+    PAGE_STAY = PAGE_COUNT, /* returned by update to keep running the page */
+} page_id_t;
+
+/* A page runs on the display task as enter, update until it returns the next
+ * page, and exit. Pages return to the task instead of calling each other,
+ * so the stack doesn't grow with the navigation. enter and exit are optional */
 typedef struct {
-    u8g2_uint_t width;
-    u8g2_uint_t offset;
-    TickType_t  flank_tcount; /* The count of ticks when track reached a flank (left or right) */
-    bool        on_right_flank; /* Track is freezed on the right flank */
-} msg_info_t;
+    const char* name;
+    void (*enter)();
+    page_id_t (*update)();
+    void (*exit)();
+} page_t;
+
+typedef struct {
+    const char*  title;
+    const char*  items; /*!< Separated by '\n' */
+    page_id_t    next[MENU_MAX_ITEMS]; /*!< Page of each item, PAGE_STAY for none */
+    sl_rest_cb_t rest; /*!< The cursor rested on an item, or NULL */
+    uint16_t     last; /*!< Item selected last time, the cursor starts there. First is 1, 0 for none */
+} menu_t;
+
+typedef enum {
+    paused,
+    playing,
+    toBePaused,
+    toBeUnpaused,
+} track_state_t;
+
+// now playing state, kept between updates
+typedef struct {
+    bool           ready; /*!< The current track arrived */
+    marquee_t      marquee;
+    render_sched_t sched;
+    TickType_t     start; /*!< Tick of the last progress update */
+    time_t         progress_base; /*!< Progress at start */
+    time_t         last_progress;
+    time_t         progress_ms;
+    time_t         duration_ms;
+    char           mins[3];
+    char           secs[3];
+    track_state_t  track_state;
+} now_playing_t;
+
+typedef enum {
+    CACHE_EMPTY,
+    CACHE_FETCHING, /*!< Asked to the client, the answer didn't arrive yet */
+    CACHE_READY, /*!< The table holds the answer, nothing writes it */
+} cache_state_t;
+
+// a list kept for a while, so its page can open with the data ready
+typedef struct {
+    const char*            name;
+    void                   (*fetch_async)(uint32_t generation);
+    u8g2_items_list_t*     list;
+    uint32_t               ttl_ms;
+    cache_state_t          state;
+    uint32_t               generation; /*!< Of the last fetch, only its answer is kept */
+    spotify_client_event_t result; /*!< Answer kept, while ready */
+    TickType_t             fetched; /*!< Tick the answer arrived */
+    bool                   used; /*!< A page showed the answer */
+    /* Statistics */
+    uint32_t               prefetches;
+    uint32_t               hits; /*!< Page opened with the answer ready */
+    uint32_t               late; /*!< Page opened with the fetch in flight */
+    uint32_t               misses; /*!< Page opened with nothing fetched */
+    uint32_t               wasted; /*!< Answers expired without being shown */
+    uint32_t               stale; /*!< Answers to older or cancelled fetches, dropped */
+} list_cache_t;
+
+// volume page state, kept between updates
+typedef struct {
+    int        level;
+    bool       unsent; /*!< Level changed since the last request */
+    TickType_t send_at;
+} volume_page_t;
 
 /* Private function prototypes -----------------------------------------------*/
+static void events_init(QueueHandle_t encoder_queue_hlr);
 static void setup_display();
 static void display_task(void* arg);
-static void initial_menu_page();
-static void system_menu_page();
-static void now_playing_page();
-static void now_playing_context_menu();
-static void playlists_page();
-static void available_devices_page();
-static void change_volume_page();
-static void delete_wifi_page();
-static void restart_page();
+static page_id_t main_menu_update();
+static page_id_t system_menu_update();
+static page_id_t track_menu_update();
+static page_id_t menu_update(menu_t* menu);
+static void now_playing_enter();
+static page_id_t now_playing_update();
+static bool wait_player_state(display_event_t* event);
+static void now_playing_exit();
+static void playlists_enter();
+static page_id_t playlists_update();
+static void devices_enter();
+static page_id_t devices_update();
+static void volume_enter();
+static page_id_t volume_update();
+static page_id_t delete_wifi_update();
+static page_id_t restart_update();
+static page_id_t test_message_update();
+static wake_t wait_event(TickType_t ticks, input_event_t* input, display_event_t* event);
+static bool read_client_event(display_event_t* event, TickType_t ticks);
+static bool read_client_answer(display_event_t* event, spotify_client_event_t ok,
+    spotify_client_event_t fail, TickType_t ticks);
+static void drain_client_events(void* ctx);
+static bool fetch_list(list_cache_t* cache, display_event_t* event);
+static void main_menu_rest(void* ctx, uint16_t index);
+static void list_cache_prefetch(list_cache_t* cache);
+static void list_cache_fetch(list_cache_t* cache);
+static list_cache_t* list_cache_answer(const display_event_t* event);
+static void list_cache_expire(list_cache_t* cache);
+static void list_cache_drop(list_cache_t* cache);
+static void list_cache_cancel();
+static void log_list_cache(const list_cache_t* cache);
 static void draw_volume_bars(uint8_t percent);
+static TickType_t progress_deadline(time_t progress_ms, time_t duration_ms, uint16_t max_bar_width, TickType_t now);
 static void print_message(const char* msg, uint8_t y, const uint8_t* font, uint8_t times);
-static void test_large_msg();
+static void now_playing_marquee_init(marquee_t* marquee);
+static void now_playing_set_texts(marquee_t* marquee, uint16_t changes);
+static void read_track_text(uint8_t region, char* out, size_t size);
+static void join_artists(const TrackInfo* track, char* out, size_t size);
+static void log_glyph_cache();
+static const char* str_table_item(void* ctx, uint16_t index, uint16_t* len);
 
 /* Locally scoped variables --------------------------------------------------*/
-static QueueHandle_t encoder;
-static const char*   TAG = "DISPLAY";
-static u8g2_t        s_u8g2;
+static input_t           s_input; /* reads the encoder queue */
+static QueueHandle_t     s_client_events; /* display_event_t posted by the client */
+static QueueSetHandle_t  s_events; /* encoder queue and s_client_events */
+static atomic_uint       s_dropped_events; /* posted with s_client_events full */
+static const char*       TAG = "DISPLAY";
+static u8g2_t            s_u8g2;
+/* Strip buffers. print_message() borrows the title one, pages never overlap */
+static uint8_t           s_title_buf[MARQUEE_BUF_SIZE(REGION_MAX_WIDTH, 3)];
+static uint8_t           s_artists_buf[MARQUEE_BUF_SIZE(REGION_MAX_WIDTH, 2)];
+static uint8_t           s_album_buf[MARQUEE_BUF_SIZE(REGION_MAX_WIDTH, 2)];
+static uint8_t           s_device_buf[MARQUEE_BUF_SIZE(DEVICE_MAX_WIDTH, 2)];
+static marquee_region_t  s_regions[NOW_PLAYING_REGIONS];
+static now_playing_t     s_now_playing;
+static volume_page_t     s_volume;
+static list_cache_t      s_playlists = {
+    .name = "playlists",
+    .fetch_async = http_user_playlists_async,
+    .list = &PLAYLISTS,
+    .ttl_ms = PLAYLISTS_TTL_MS,
+};
+static list_cache_t      s_devices = {
+    .name = "devices",
+    .fetch_async = http_available_devices_async,
+    .list = &DEVICES,
+    .ttl_ms = DEVICES_TTL_MS,
+};
+static list_cache_t*     LIST_CACHES[] = { &s_playlists, &s_devices };
+
+static menu_t MAIN_MENU = {
+    "Spotify",
+    "Available devices\nNow playing\nMy playlists\nSystem\nTest message",
+    { PAGE_DEVICES, PAGE_NOW_PLAYING, PAGE_PLAYLISTS, PAGE_SYSTEM_MENU, PAGE_TEST_MESSAGE },
+    main_menu_rest,
+};
+static menu_t SYSTEM_MENU = {
+    "System",
+    "Delete wifi\nRestart\nBack",
+    { PAGE_DELETE_WIFI, PAGE_RESTART, PAGE_MAIN_MENU },
+};
+static menu_t TRACK_MENU = {
+    "Track options",
+    "change volume\nartist\nqueue\nBack\nMain Menu",
+    { PAGE_VOLUME, PAGE_STAY, PAGE_STAY, PAGE_NOW_PLAYING, PAGE_MAIN_MENU },
+};
+
+static const page_t PAGES[PAGE_COUNT] = {
+    [PAGE_MAIN_MENU] = { "main menu", NULL, main_menu_update, NULL },
+    [PAGE_SYSTEM_MENU] = { "system menu", NULL, system_menu_update, NULL },
+    [PAGE_TRACK_MENU] = { "track menu", NULL, track_menu_update, NULL },
+    [PAGE_NOW_PLAYING] = { "now playing", now_playing_enter, now_playing_update, now_playing_exit },
+    [PAGE_PLAYLISTS] = { "playlists", playlists_enter, playlists_update, NULL },
+    [PAGE_DEVICES] = { "devices", devices_enter, devices_update, NULL },
+    [PAGE_VOLUME] = { "volume", volume_enter, volume_update, NULL },
+    [PAGE_DELETE_WIFI] = { "delete wifi", NULL, delete_wifi_update, NULL },
+    [PAGE_RESTART] = { "restart", NULL, restart_update, NULL },
+    [PAGE_TEST_MESSAGE] = { "test message", NULL, test_message_update, NULL },
+};
 
 /* Globally scoped variables definitions -------------------------------------*/
 TaskHandle_t DISPLAY_TASK = NULL;
@@ -69,17 +279,319 @@ TaskHandle_t DISPLAY_TASK = NULL;
 /* Exported functions --------------------------------------------------------*/
 void display_init(UBaseType_t priority, QueueHandle_t encoder_queue_hlr)
 {
-    encoder = encoder_queue_hlr;
-    int res = xTaskCreate(display_task, "display_task", 4096, NULL, priority, &DISPLAY_TASK);
+    events_init(encoder_queue_hlr);
+    overlay_init(); /* before any task can send an error */
+    int res = xTaskCreate(display_task, "display_task", DISPLAY_TASK_STACK, NULL, priority, &DISPLAY_TASK);
     assert((res == pdPASS) && "Error creating task");
 }
 
 void send_err(const char* msg)
 {
-    DRAW_STR_CLR(0, 35, NOTIF_FONT, msg);
+    overlay_show_text(msg, TOAST_MS);
+}
+
+/**
+ * @brief Queue an event for the display task, without waiting. Events are
+ * read in order. If the display is so far behind that the queue is full,
+ * the event is dropped and counted.
+ *
+ * @retval false if the event was dropped
+ */
+bool display_post(const display_event_t* event)
+{
+    if (pdTRUE == xQueueSend(s_client_events, event, 0))
+        return true;
+
+    unsigned dropped = atomic_fetch_add(&s_dropped_events, 1) + 1;
+    ESP_LOGW(TAG, "Event queue full, event %d dropped (%u so far)", event->type, dropped);
+    return false;
 }
 
 /* Private functions ---------------------------------------------------------*/
+static void events_init(QueueHandle_t encoder_queue_hlr)
+{
+    /* a set needs room for every item its members can hold */
+    UBaseType_t encoder_len = uxQueueMessagesWaiting(encoder_queue_hlr)
+        + uxQueueSpacesAvailable(encoder_queue_hlr);
+    s_client_events = xQueueCreate(CLIENT_EVENTS_LEN, sizeof(display_event_t));
+    s_events = xQueueCreateSet(encoder_len + CLIENT_EVENTS_LEN);
+    assert(s_client_events && s_events && "Error creating the event set");
+    xQueueAddToSet(encoder_queue_hlr, s_events);
+    xQueueAddToSet(s_client_events, s_events);
+
+    input_init(&s_input, encoder_queue_hlr, s_events);
+    input_set_other_cb(&s_input, drain_client_events, NULL);
+}
+
+/**
+ * @brief Block until the encoder turns or is pressed, a client event
+ * arrives or ticks elapse, whichever comes first. A single wait on the
+ * queue set, so nothing is polled.
+ *
+ * Members are read directly and each read takes one entry of the set, so
+ * the set never holds more entries than items queued. The entry taken here
+ * may belong to an item still queued: every source is checked before
+ * blocking again, so it isn't missed.
+ *
+ */
+static wake_t wait_event(TickType_t ticks, input_event_t* input, display_event_t* event)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (1) {
+        /* input first, and what arrived while the page was busy */
+        if (input_read(&s_input, input, 0))
+            return WAKE_INPUT;
+        if (read_client_event(event, 0))
+            return WAKE_CLIENT;
+
+        TickType_t left = portMAX_DELAY;
+        if (ticks != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks)
+                return WAKE_TIMEOUT;
+            left = ticks - elapsed;
+        }
+        if (xQueueSelectFromSet(s_events, left) == NULL)
+            return WAKE_TIMEOUT;
+    }
+}
+
+/**
+ * @brief Every client event goes through here, an answer to a list fetch is
+ * kept in its cache whatever page reads it.
+ *
+ */
+static bool read_client_event(display_event_t* event, TickType_t ticks)
+{
+    if (pdTRUE != xQueueReceive(s_client_events, event, ticks))
+        return false;
+    xQueueSelectFromSet(s_events, 0); /* see wait_event() */
+    list_cache_answer(event);
+    return true;
+}
+
+/**
+ * @brief Read client events until ok or fail, the others are read as
+ * usual. What a page waits for can be queued behind anything.
+ *
+ * @retval false on timeout, event holds the last one read
+ */
+static bool read_client_answer(display_event_t* event, spotify_client_event_t ok,
+    spotify_client_event_t fail, TickType_t ticks)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (1) {
+        TickType_t left = portMAX_DELAY;
+        if (ticks != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks)
+                return false;
+            left = ticks - elapsed;
+        }
+        if (!read_client_event(event, left))
+            return false;
+        if (event->type == ok || event->type == fail)
+            return true;
+    }
+}
+
+/**
+ * @brief While a selection list waits for input, the client events have no
+ * page to go to: list answers are cached, the rest are dropped instead of
+ * filling up the queue.
+ *
+ */
+static void drain_client_events(void* ctx)
+{
+    display_event_t event;
+
+    while (read_client_event(&event, 0))
+        ;
+}
+
+/**
+ * @brief Get the list of the cache, fetched in the background unless it was
+ * prefetched. A button press meanwhile cancels the fetch, so a large
+ * download doesn't hold the user or the lane. An answer to an older fetch,
+ * read before or after the new one is asked, is dropped by its generation.
+ *
+ * @retval false if the user left, event holds nothing
+ */
+static bool fetch_list(list_cache_t* cache, display_event_t* event)
+{
+    input_event_t input;
+
+    while (read_client_event(event, 0)) /* answers are kept, the rest is stale */
+        ;
+    list_cache_expire(cache);
+    if (cache->state == CACHE_READY) {
+        cache->hits++;
+    } else if (cache->state == CACHE_FETCHING) {
+        cache->late++;
+    } else {
+        cache->misses++;
+        list_cache_fetch(cache);
+    }
+    log_list_cache(cache);
+
+    while (cache->state == CACHE_FETCHING) {
+        wake_t wake = wait_event(portMAX_DELAY, &input, event);
+
+        if (wake == WAKE_INPUT && input.type == BUTTON_EVENT) {
+            ESP_LOGD(TAG, "Fetch cancelled");
+            list_cache_cancel();
+            return false;
+        }
+        if (wake == WAKE_CLIENT && cache->state == CACHE_EMPTY) { /* timed out or failed */
+            overlay_show_text(event->type == PLAYLISTS_TIMED_OUT || event->type == DEVICES_TIMED_OUT
+                    ? "Request timed out"
+                    : "Request failed",
+                TOAST_MS);
+            return true;
+        }
+    }
+    cache->used = true;
+    event->type = cache->result;
+    return true;
+}
+
+/**
+ * @brief Prefetch the list the main menu item leads to.
+ *
+ */
+static void main_menu_rest(void* ctx, uint16_t index)
+{
+    if (MAIN_MENU.next[index] == PAGE_PLAYLISTS) {
+        list_cache_prefetch(&s_playlists);
+    } else if (MAIN_MENU.next[index] == PAGE_DEVICES) {
+        list_cache_prefetch(&s_devices);
+    }
+}
+
+static void list_cache_prefetch(list_cache_t* cache)
+{
+    display_event_t event;
+
+    while (read_client_event(&event, 0)) /* see fetch_list() */
+        ;
+    list_cache_expire(cache);
+    if (cache->state != CACHE_EMPTY)
+        return;
+    ESP_LOGD(TAG, "Prefetching %s", cache->name);
+    cache->prefetches++;
+    list_cache_fetch(cache);
+}
+
+/**
+ * @brief Ask the client for the list, with a new generation. The answers
+ * to the fetches asked before are stale from now on.
+ *
+ */
+static void list_cache_fetch(list_cache_t* cache)
+{
+    cache->generation++;
+    cache->state = CACHE_FETCHING;
+    cache->fetch_async(cache->generation);
+}
+
+/**
+ * @brief Keep the answer to a list fetch in its cache. A timeout or a
+ * failure leaves the cache empty. An answer to another fetch than the one
+ * in flight is dropped: its table may be half written by a newer fetch.
+ *
+ * @retval NULL if the event isn't the answer to the fetch in flight
+ */
+static list_cache_t* list_cache_answer(const display_event_t* event)
+{
+    list_cache_t* cache;
+
+    switch (event->type) {
+    case PLAYLISTS_EMPTY:
+    case PLAYLISTS_OK:
+    case PLAYLISTS_TIMED_OUT:
+    case PLAYLISTS_FAILED:
+        cache = &s_playlists;
+        break;
+    case ACTIVE_DEVICES_FOUND:
+    case NO_ACTIVE_DEVICES:
+    case DEVICES_TIMED_OUT:
+    case DEVICES_FAILED:
+        cache = &s_devices;
+        break;
+    default:
+        return NULL;
+    }
+    if (cache->state != CACHE_FETCHING || event->generation != cache->generation) {
+        ESP_LOGD(TAG, "Stale %s answer %d (generation %u, expected %u)", cache->name,
+            event->type, event->generation, cache->generation);
+        cache->stale++;
+        return NULL;
+    }
+    if (event->type == PLAYLISTS_TIMED_OUT || event->type == DEVICES_TIMED_OUT
+        || event->type == PLAYLISTS_FAILED || event->type == DEVICES_FAILED) {
+        cache->state = CACHE_EMPTY;
+    } else {
+        cache->state = CACHE_READY;
+        cache->result = event->type;
+        cache->fetched = xTaskGetTickCount();
+        cache->used = false;
+    }
+    return cache;
+}
+
+static void list_cache_expire(list_cache_t* cache)
+{
+    if (cache->state == CACHE_READY
+        && pdTICKS_TO_MS(xTaskGetTickCount() - cache->fetched) >= cache->ttl_ms) {
+        if (!cache->used)
+            cache->wasted++;
+        list_cache_drop(cache);
+    }
+}
+
+/**
+ * @brief Free the list. Only a ready one: while fetching, the player task
+ * writes the table.
+ *
+ */
+static void list_cache_drop(list_cache_t* cache)
+{
+    if (cache->state != CACHE_READY)
+        return;
+    strTableClear(&cache->list->names);
+    strTableClear(&cache->list->values);
+    cache->state = CACHE_EMPTY;
+}
+
+/**
+ * @brief Abort the background request and forget the fetches in flight. An
+ * answer sent before the cancel reached the client is stale by its
+ * generation.
+ *
+ */
+static void list_cache_cancel()
+{
+    http_cancel_background();
+    for (size_t i = 0; i < sizeof(LIST_CACHES) / sizeof(LIST_CACHES[0]); i++) {
+        if (LIST_CACHES[i]->state == CACHE_FETCHING) {
+            LIST_CACHES[i]->state = CACHE_EMPTY;
+            LIST_CACHES[i]->generation++;
+        }
+    }
+}
+
+static void log_list_cache(const list_cache_t* cache)
+{
+    uint32_t opens = cache->hits + cache->late + cache->misses;
+
+    ESP_LOGI(TAG, "%s cache: %u prefetches, %u wasted, %u stale, %u opens: %u ready, "
+                  "%u in flight, %u missed (%u%% hits)",
+        cache->name, cache->prefetches, cache->wasted, cache->stale, opens, cache->hits,
+        cache->late, cache->misses, opens ? cache->hits * 100 / opens : 0);
+}
+
 static void draw_volume_bars(uint8_t percent)
 {
     uint8_t max_height = s_u8g2.height / 2;
@@ -91,21 +603,61 @@ static void draw_volume_bars(uint8_t percent)
         uint8_t y = s_u8g2.height - bar_height;
         u8g2_DrawBox(&s_u8g2, x, y, BAR_WIDTH, bar_height);
     }
-    u8g2_SendBuffer(&s_u8g2);
+    u8g2_SetFont(&s_u8g2, MENU_FONT);
+    u8g2_DrawStr(&s_u8g2, 0, 12, u8x8_u8toa(percent, 3));
+    display_flush(&s_u8g2);
+}
+
+/**
+ * @brief Tick when the time or the progress bar shown for progress_ms
+ * changes, assuming the track keeps playing.
+ *
+ */
+static TickType_t progress_deadline(time_t progress_ms, time_t duration_ms, uint16_t max_bar_width, TickType_t now)
+{
+    time_t wait_ms = 1000 - progress_ms % 1000; /* next second */
+
+    if (duration_ms > 0) {
+        time_t bar_width = progress_ms * max_bar_width / duration_ms;
+        time_t next_px = ((bar_width + 1) * duration_ms + max_bar_width - 1) / max_bar_width;
+        if (next_px - progress_ms < wait_ms)
+            wait_ms = next_px - progress_ms;
+    }
+    return now + MS_TO_TICKS_CEIL(wait_ms);
 }
 
 static void display_task(void* args)
 {
+    page_id_t page = PAGE_MAIN_MENU;
+
     setup_display();
 
+    if (PAGES[page].enter)
+        PAGES[page].enter();
     while (1) {
-        initial_menu_page(&s_u8g2);
+        page_id_t next = PAGES[page].update();
+        if (next == PAGE_STAY)
+            continue;
+
+        if (PAGES[page].exit)
+            PAGES[page].exit();
+        /* pages don't nest anymore, the mark must stay the same */
+        ESP_LOGD(TAG, "%s -> %s, stack high water mark: %u", PAGES[page].name,
+            PAGES[next].name, uxTaskGetStackHighWaterMark(NULL));
+        page = next;
+        if (PAGES[page].enter)
+            PAGES[page].enter();
     }
     assert(false && "Unexpected exit of infinite task loop");
 }
 
 static void setup_display()
 {
+#ifdef DISPLAY_HEADLESS
+    /* no LCD attached, see test/host: frames are kept in memory by display_flush */
+    display_flush_init(u8x8_byte_empty);
+    u8g2_Setup_st7920_s_128x64_f(&s_u8g2, U8G2_R0, display_flush_byte_cb, u8x8_dummy_cb);
+#else
     u8g2_esp32_hal_t u8g2_esp32_hal = U8G2_ESP32_HAL_DEFAULT(U8G2_ESP32_HAL_SPI_DEFAULT);
     u8g2_esp32_hal.clk = GPIO_NUM_14;
     u8g2_esp32_hal.mosi = GPIO_NUM_13;
@@ -114,464 +666,606 @@ static void setup_display()
 
     u8g2_esp32_hal_init(u8g2_esp32_hal);
 
-    u8g2_Setup_st7920_s_128x64_f(&s_u8g2, U8G2_R0, u8g2_esp32_spi_byte_cb,
+    /* bytes go through display_flush to be counted */
+    display_flush_init(u8g2_esp32_spi_byte_cb);
+    u8g2_Setup_st7920_s_128x64_f(&s_u8g2, U8G2_R0, display_flush_byte_cb,
         u8g2_esp32_gpio_and_delay_cb); // init u8g2 structure
+#endif
 
     u8g2_InitDisplay(&s_u8g2); // send init sequence to the display, display is in sleep mode after this
     u8g2_ClearDisplay(&s_u8g2);
     u8g2_SetPowerSave(&s_u8g2, 0); // wake up display
+
+    unifont_init();
 }
 
-static void initial_menu_page()
+/**
+ * @brief Show menu until an item is selected. A long press stays on it.
+ * The cursor starts on the item selected last time.
+ *
+ */
+static page_id_t menu_update(menu_t* menu)
 {
-    uint8_t selection = 1;
+    sl_source_t source = sl_string_source(menu->items);
+    source.rest = menu->rest;
+    source.rest_ticks = pdMS_TO_TICKS(PREFETCH_REST_MS);
 
     u8g2_SetFont(&s_u8g2, MENU_FONT);
+    uint16_t selection = userInterfaceSelectionListSource(&s_u8g2, &s_input,
+        menu->title, menu->last, &source, portMAX_DELAY);
 
-    do {
-        selection = userInterfaceSelectionList(&s_u8g2, encoder,
-            "Spotify", selection,
-            "Available devices\nNow playing\nMy playlists\nSystem\nTest message",
-            portMAX_DELAY);
-        switch (selection) {
-        case 1:
-            return available_devices_page();
-        case 2:
-            return now_playing_page();
-        case 3:
-            return playlists_page();
-        case 4:
-            return system_menu_page();
-        case 5:
-            return test_large_msg();
-        default:
-            break;
-        }
-    } while (1);
+    if (selection == 0 || selection > MENU_MAX_ITEMS)
+        return PAGE_STAY;
+    menu->last = selection;
+    return menu->next[selection - 1];
 }
 
-static void playlists_page()
+static page_id_t main_menu_update()
+{
+    for (size_t i = 0; i < sizeof(LIST_CACHES) / sizeof(LIST_CACHES[0]); i++)
+        list_cache_expire(LIST_CACHES[i]);
+    return menu_update(&MAIN_MENU);
+}
+static void playlists_enter()
 {
     DRAW_STR_CLR(0, 20, NOTIF_FONT, "Retrieving user playlists...");
+}
 
-    uint8_t selection = 1;
+static page_id_t playlists_update()
+{
+    page_id_t       next = PAGE_NOW_PLAYING;
+    display_event_t event;
 
-    http_user_playlists();
-    uint32_t notif;
-    xTaskNotifyWait(0, ULONG_MAX, &notif, portMAX_DELAY);
+    if (!fetch_list(&s_playlists, &event))
+        return PAGE_MAIN_MENU;
 
-    if (notif == PLAYLISTS_EMPTY) {
-        DRAW_STR_CLR(0, 20, NOTIF_FONT, "User doesn't have playlists");
-        vTaskDelay(pdMS_TO_TICKS(3000));
-    } else if (notif == PLAYLISTS_OK) {
+    if (event.type == PLAYLISTS_TIMED_OUT || event.type == PLAYLISTS_FAILED) {
+        next = PAGE_MAIN_MENU;
+    } else if (event.type == PLAYLISTS_EMPTY) {
+        overlay_show_text("User doesn't have playlists", TOAST_MS);
+    } else if (event.type == PLAYLISTS_OK) {
         u8g2_ClearBuffer(&s_u8g2);
         u8g2_SetFont(&s_u8g2, MENU_FONT);
-        selection = userInterfaceSelectionList(&s_u8g2, encoder,
-            "My Playlists", selection,
-            PLAYLISTS.items_string,
+        sl_source_t source = { str_table_item, &PLAYLISTS.names, PLAYLISTS.names.count };
+        uint16_t    selection = userInterfaceSelectionListSource(&s_u8g2, &s_input,
+            "My Playlists", 1, &source,
             portMAX_DELAY);
 
-        if (selection == 0)
-            return initial_menu_page();
-
-        StrListItem* uri = PLAYLISTS.values.first;
-
-        for (uint16_t i = 1; i < selection; i++)
-            uri = uri->next;
+        if (selection == 0) {
+            next = PAGE_MAIN_MENU;
+        } else {
+            uint16_t    uri_len;
+            const char* uri = strTableGet(&PLAYLISTS.values, selection - 1, &uri_len);
 
-        ESP_LOGD(TAG, "URI selected: %s", uri->str);
+            ESP_LOGD(TAG, "URI selected: %.*s", uri_len, uri);
 
-        http_play_context_uri(uri->str);
-        vTaskDelay(50);
-        UNBLOCK_PLAYER_TASK;
-    }
-    /* cleanup */
-    if (PLAYLISTS.items_string) {
-        free(PLAYLISTS.items_string);
-        PLAYLISTS.items_string = NULL;
+            http_play_context_uri(uri, uri_len);
+            vTaskDelay(50);
+            UNBLOCK_PLAYER_TASK;
+        }
     }
-    strListClear(&PLAYLISTS.values);
-
-    return now_playing_page();
+    /* the list stays cached until it expires */
+    return next;
 }
-
-static void now_playing_page()
+static void now_playing_enter()
 {
+    /* lists are cached while browsing the menus, not during playback: a
+     * prefetch still in flight is cancelled, its answer won't be kept */
+    for (size_t i = 0; i < sizeof(LIST_CACHES) / sizeof(LIST_CACHES[0]); i++) {
+        if (LIST_CACHES[i]->state == CACHE_FETCHING) {
+            list_cache_cancel();
+            break;
+        }
+    }
+    for (size_t i = 0; i < sizeof(LIST_CACHES) / sizeof(LIST_CACHES[0]); i++)
+        list_cache_drop(LIST_CACHES[i]);
     ENABLE_PLAYER_TASK;
     DRAW_STR_CLR(0, 20, NOTIF_FONT, "Retrieving player state...");
+    s_now_playing.ready = false;
+}
 
-    /* wait for the current track */
-
-    uint32_t notif;
-    xTaskNotifyWait(0, ULONG_MAX, &notif, portMAX_DELAY);
-
-    if (notif == LAST_DEVICE_FAILED) {
-        DISABLE_PLAYER_TASK;
-        ESP_LOGD(TAG, "No device playing");
-        DRAW_STR_CLR(0, 20, NOTIF_FONT, "No device playing");
-        vTaskDelay(pdMS_TO_TICKS(3000));
-        return available_devices_page();
+static page_id_t now_playing_update()
+{
+    now_playing_t*  np = &s_now_playing;
+    display_event_t event;
+
+    if (!np->ready) {
+        if (!wait_player_state(&event))
+            return PAGE_MAIN_MENU;
+        if (event.type == LAST_DEVICE_FAILED) {
+            ESP_LOGD(TAG, "No device playing");
+            overlay_show_text("No device playing", TOAST_MS);
+            return PAGE_DEVICES;
+        }
+        if (event.type == PLAYER_STATE_FAILED) {
+            ESP_LOGW(TAG, "No player state");
+            overlay_show_text("Can't get the player state", TOAST_MS);
+            return PAGE_MAIN_MENU;
+        }
+        now_playing_marquee_init(&np->marquee);
+        now_playing_set_texts(&np->marquee, TRACK_CHANGED_ALL);
+        render_sched_init(&np->sched);
+        np->start = xTaskGetTickCount();
+        np->progress_base = event.track.progress_ms;
+        np->duration_ms = event.track.duration_ms;
+        np->last_progress = np->progress_ms = 0;
+        strcpy(np->mins, u8x8_u8toa(np->progress_base / 60000, 2));
+        strcpy(np->secs, u8x8_u8toa((np->progress_base / 1000) % 60, 2));
+        np->track_state = event.track.is_playing ? playing : paused;
+        np->ready = true;
     }
-    // else...
-    u8g2_SetFont(&s_u8g2, TRACK_NAME_FONT);
-    msg_info_t trk = INIT_MSG_INFO(TRACK->name);
-    TickType_t start = xTaskGetTickCount();
-    time_t     progress_base = TRACK->progress_ms;
-    time_t     last_progress = 0, progress_ms = 0;
-    char       mins[3], secs[3];
-    strcpy(mins, u8x8_u8toa(progress_base / 60000, 2));
-    strcpy(secs, u8x8_u8toa((progress_base / 1000) % 60, 2));
-    enum {
-        paused,
-        playing,
-        toBePaused,
-        toBeUnpaused,
-    } track_state
-        = TRACK->isPlaying ? playing : paused;
 
-    while (1) {
+    /* Wait for input, a track event or the next frame -----------------------------*/
+
+    input_event_t input;
+    wake_t        wake = wait_event(render_sched_wait_ticks(&np->sched), &input, &event);
 
-        /* Intercept any encoder event -----------------------------------------------*/
-
-        rotary_encoder_event_t queue_event;
-        if (pdTRUE == xQueueReceive(encoder, &queue_event, 0)) {
-            if (queue_event.event_type == BUTTON_EVENT) {
-                switch (queue_event.btn_event) {
-                case SHORT_PRESS:
-                    track_state = TRACK->isPlaying ? toBePaused : toBeUnpaused;
-                    player_cmd(&queue_event);
-                    break;
-                case MEDIUM_PRESS:
-                    DISABLE_PLAYER_TASK;
-                    return now_playing_context_menu();
-                    break;
-                case LONG_PRESS:
-                    DISABLE_PLAYER_TASK;
-                    return initial_menu_page();
-                    break;
-                }
-            } else { /* ROTARY_ENCODER_EVENT intercepted */
-                player_cmd(&queue_event);
-                /* now block the task to ignore the values the ISR is storing
-                 * in the queue while the rotary encoder is still moving */
-                vTaskDelay(pdMS_TO_TICKS(500));
-                /* The task is active again. Reset the queue to discard
-                 * the last move of the rotary encoder */
-                xQueueReset(encoder);
+    if (wake == WAKE_INPUT) {
+        if (input.type == BUTTON_EVENT) {
+            switch (input.btn_event) {
+            case SHORT_PRESS:
+                np->track_state = np->track_state == playing || np->track_state == toBeUnpaused
+                    ? toBePaused
+                    : toBeUnpaused;
+                player_cmd(cmdToggle);
+                break;
+            case MEDIUM_PRESS:
+                return PAGE_TRACK_MENU;
+            case LONG_PRESS:
+                return PAGE_MAIN_MENU;
             }
+        } else if (input.new_gesture && input.delta) { /* one track per gesture */
+            player_cmd(input.delta > 0 ? cmdPrev : cmdNext);
+            render_sched_invalidate(&np->sched);
+            /* the detents queued while the command was sent are
+             * the same gesture, they don't skip another track */
+            input_continue_gesture(&s_input);
         }
+    } else if (wake == WAKE_CLIENT) {
+        switch (event.type) {
+        case TRACK_UPDATED: {
+            uint16_t changes = event.track.changes;
+            ESP_LOGD(TAG, "Track updated: 0x%03x", changes);
+            if (changes & TRACK_CHANGED_VOLUME)
+                overlay_show_volume(event.track.volume_percent, VOLUME_OVERLAY_MS);
+            if (changes & TRACK_CHANGED_ITEM)
+                np->last_progress = 0;
+            /* only the texts that changed are measured and rendered again */
+            now_playing_set_texts(&np->marquee, changes);
+            if (changes & TRACK_CHANGED_PROGRESS) {
+                np->start = xTaskGetTickCount();
+                np->progress_base = event.track.progress_ms;
+                np->duration_ms = event.track.duration_ms;
+                np->track_state = event.track.is_playing ? playing : paused;
+            }
+            if (changes & ~TRACK_CHANGED_VOLUME) /* the overlay redraws itself */
+                render_sched_invalidate(&np->sched);
+            break;
+        }
+        case LAST_DEVICE_FAILED:
+            ESP_LOGW(TAG, "Last device failed");
+            overlay_show_text("Device disconected...", TOAST_MS);
+            return PAGE_DEVICES;
+        default:
+            break;
+        }
+    }
 
-        /* Wait for track event ------------------------------------------------------*/
+    /* Progress is derived from the ticks elapsed since the last update */
+    TickType_t now = xTaskGetTickCount();
+    switch (np->track_state) {
+    case playing:;
+        time_t prg = np->progress_base + pdTICKS_TO_MS(now - np->start);
+        /* track finished, early unblock of PLAYER_TASK */
+        if (prg > np->duration_ms) {
+            /* only notify once */
+            if (np->progress_ms != np->duration_ms) {
+                np->progress_ms = np->duration_ms;
+                vTaskDelay(50);
+                ESP_LOGW(TAG, "End of track, unblock playing task");
+                UNBLOCK_PLAYER_TASK;
+            }
+        } else {
+            np->progress_ms = prg;
+        }
+        break;
+    case paused:
+        np->progress_ms = np->progress_base;
+        break;
+    case toBePaused:
+        np->track_state = paused;
+        np->progress_base = np->progress_ms;
+        break;
+    case toBeUnpaused:
+        np->track_state = playing;
+        np->start = now;
+        break;
+    default:
+        break;
+    }
+    strcpy(np->mins, u8x8_u8toa(np->progress_ms / 60000, 2));
+    /* if there's an increment of one second */
+    if ((np->progress_ms / 1000) != (np->last_progress / 1000)) {
+        np->last_progress = np->progress_ms;
+        strcpy(np->secs, u8x8_u8toa((np->progress_ms / 1000) % 60, 2));
+        ESP_LOGD(TAG, "Time: %s:%s", np->mins, np->secs);
+    }
 
-        if (pdPASS == xTaskNotifyWait(0, ULONG_MAX, &notif, pdMS_TO_TICKS(50))) {
-            start = xTaskGetTickCount();
-            progress_base = TRACK->progress_ms;
+    if (!render_sched_begin_frame(&np->sched))
+        return PAGE_STAY;
 
-            if (notif == VOLUME_CHANGED) {
-                ESP_LOGD(TAG, "Volume changed");
-                uint8_t percent = atoi(TRACK->device.volume_percent);
-                draw_volume_bars(percent);
-                vTaskDelay(pdMS_TO_TICKS(2000));
-            }
+    /* Display track information -------------------------------------------------*/
 
-            if (notif == SAME_TRACK) {
-                ESP_LOGD(TAG, "Same track event");
-            } else if (notif == NEW_TRACK) {
-                ESP_LOGD(TAG, "New track event");
-                last_progress = trk.offset = 0;
-                u8g2_SetFont(&s_u8g2, TRACK_NAME_FONT);
-                trk.width = u8g2_GetUTF8Width(&s_u8g2, TRACK->name);
-            } else if (notif == LAST_DEVICE_FAILED) {
-                DISABLE_PLAYER_TASK;
-                ESP_LOGW(TAG, "Last device failed");
-                DRAW_STR_CLR(0, 20, NOTIF_FONT, "Device disconected...");
-                vTaskDelay(pdMS_TO_TICKS(3000));
-                return available_devices_page();
-            }
+    u8g2_ClearBuffer(&s_u8g2);
 
-            track_state = TRACK->isPlaying ? playing : paused;
-
-        } else { /* expired */
-            TickType_t finish = xTaskGetTickCount();
-            switch (track_state) {
-            case playing:;
-                time_t prg = progress_base + pdTICKS_TO_MS(finish - start);
-                /* track finished, early unblock of PLAYER_TASK */
-                if (prg > TRACK->duration_ms) {
-                    /* only notify once */
-                    if (progress_ms != TRACK->duration_ms) {
-                        progress_ms = TRACK->duration_ms;
-                        vTaskDelay(50);
-                        ESP_LOGW(TAG, "End of track, unblock playing task");
-                        UNBLOCK_PLAYER_TASK;
-                    }
-                } else {
-                    progress_ms = prg;
-                }
-                break;
-            case paused:
-                progress_ms = progress_base;
-                break;
-            case toBePaused:
-                track_state = paused;
-                progress_base = progress_ms;
-                break;
-            case toBeUnpaused:
-                track_state = playing;
-                start = xTaskGetTickCount();
-                break;
-            default:
-                break;
-            }
-            strcpy(mins, u8x8_u8toa(progress_ms / 60000, 2));
-            /* if there's an increment of one second */
-            if ((progress_ms / 1000) != (last_progress / 1000)) {
-                last_progress = progress_ms;
-                strcpy(secs, u8x8_u8toa((progress_ms / 1000) % 60, 2));
-                ESP_LOGD(TAG, "Time: %s:%s", mins, secs);
-            }
-        }
+    /* Device, track name, artists and album, scrolled when they don't fit */
+    TickType_t next_scroll = marquee_draw(&np->marquee, now);
+    if (next_scroll != RENDER_NO_DEADLINE)
+        render_sched_request(&np->sched, next_scroll);
+
+    /* Time progress */
+    u8g2_SetFont(&s_u8g2, TIME_FONT);
+    u8g2_DrawStr(&s_u8g2, 0, s_u8g2.height, np->mins);
+    u8g2_DrawStr(&s_u8g2, u8g2_GetStrWidth(&s_u8g2, np->mins) - 1, s_u8g2.height, ":");
+    u8g2_DrawStr(&s_u8g2, u8g2_GetStrWidth(&s_u8g2, np->mins) + 3, s_u8g2.height, np->secs);
+
+    /* Progress bar */
+    const uint16_t max_bar_width = s_u8g2.width - 20;
+    u8g2_DrawFrame(&s_u8g2, 20, s_u8g2.height - 5, max_bar_width, 5);
+    float progress_percent = ((float)(np->progress_ms)) / np->duration_ms;
+    long  bar_width = progress_percent * max_bar_width;
+    u8g2_DrawBox(&s_u8g2, 20, s_u8g2.height - 5, (u8g2_uint_t)bar_width, 5);
+
+    display_flush(&s_u8g2);
+
+    if (np->track_state == playing)
+        render_sched_request(&np->sched, progress_deadline(np->progress_ms, np->duration_ms, max_bar_width, now));
+    render_sched_end_frame(&np->sched);
+    return PAGE_STAY;
+}
 
-        /* Display track information -------------------------------------------------*/
+/**
+ * @brief Wait for the first player state, the current track or why there
+ * is none. A long press gives up. A client silent for STATE_TIMEOUT_MS is
+ * taken as PLAYER_STATE_FAILED.
+ *
+ * @retval false if the user left
+ */
+static bool wait_player_state(display_event_t* event)
+{
+    TickType_t    start = xTaskGetTickCount();
+    TickType_t    timeout = pdMS_TO_TICKS(STATE_TIMEOUT_MS);
+    input_event_t input;
 
-        u8g2_SetFont(&s_u8g2, TRACK_NAME_FONT);
-        u8g2_ClearBuffer(&s_u8g2);
+    while (1) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        wake_t     wake = elapsed < timeout ? wait_event(timeout - elapsed, &input, event) : WAKE_TIMEOUT;
 
-        /* print Track name */
-        u8g2_DrawUTF8(&s_u8g2, trk.offset, 35, TRACK->name);
-
-        /* When the track doesn't fit on display, the offset is
-         * updated on each iteration to make it scroll */
-        if (trk.width > s_u8g2.width) {
-            /* ticks transcurred since reached a flank */
-            TickType_t ticks_on_flank = xTaskGetTickCount() - trk.flank_tcount;
-            /* Track can scroll if it exceeds the threshold of being frozen on one edge */
-            if (pdMS_TO_TICKS(1000) < ticks_on_flank) { /* threshold: 1000 ms */
-                if (trk.on_right_flank) { /* go to the left flank */
-                    trk.on_right_flank = false;
-                    trk.offset = 0;
-                    trk.flank_tcount = xTaskGetTickCount();
-                } else {
-                    trk.offset -= 1; // scroll by one pixel
-                    if ((u8g2_uint_t)trk.offset < (u8g2_uint_t)(s_u8g2.width - trk.width)) { /* right flank reached */
-                        trk.on_right_flank = true;
-                        trk.flank_tcount = xTaskGetTickCount();
-                    }
-                }
-            }
+        if (wake == WAKE_TIMEOUT) {
+            event->type = PLAYER_STATE_FAILED;
+            return true;
         }
-        /* Track artists */
-        /* IMPLEMENT */
-
-        /* Time progress */
-        u8g2_SetFont(&s_u8g2, TIME_FONT);
-        u8g2_DrawStr(&s_u8g2, 0, s_u8g2.height, mins);
-        u8g2_DrawStr(&s_u8g2, u8g2_GetStrWidth(&s_u8g2, mins) - 1, s_u8g2.height, ":");
-        u8g2_DrawStr(&s_u8g2, u8g2_GetStrWidth(&s_u8g2, mins) + 3, s_u8g2.height, secs);
-
-        /* Progress bar */
-        const uint16_t max_bar_width = s_u8g2.width - 20;
-        u8g2_DrawFrame(&s_u8g2, 20, s_u8g2.height - 5, max_bar_width, 5);
-        float progress_percent = ((float)(progress_ms)) / TRACK->duration_ms;
-        long  bar_width = progress_percent * max_bar_width;
-        u8g2_DrawBox(&s_u8g2, 20, s_u8g2.height - 5, (u8g2_uint_t)bar_width, 5);
-
-        u8g2_SendBuffer(&s_u8g2);
+        if (wake == WAKE_INPUT && input.type == BUTTON_EVENT && input.btn_event == LONG_PRESS)
+            return false;
+        if (wake == WAKE_CLIENT
+            && (event->type == TRACK_UPDATED || event->type == LAST_DEVICE_FAILED
+                || event->type == PLAYER_STATE_FAILED))
+            return true;
     }
 }
 
-static void now_playing_context_menu()
+static void now_playing_exit()
+{
+    DISABLE_PLAYER_TASK;
+    list_cache_cancel(); /* the poll in flight, if any */
+}
+
+static void now_playing_marquee_init(marquee_t* marquee)
 {
-    uint8_t selection = 1;
+    /* rows of each region, top and bottom (excluded). The Unicode font is
+     * 16 px tall, the rows of the menu font are cut to not overlap */
+    static const u8g2_uint_t ROWS[NOW_PLAYING_REGIONS][2] = {
+        [REGION_DEVICE] = { 0, 8 },
+        [REGION_TITLE] = { 8, 30 },
+        [REGION_ARTISTS] = { 30, 43 },
+        [REGION_ALBUM] = { 43, 57 }, /* the progress bar is below */
+    };
+
+    marquee_region_init(&s_regions[REGION_DEVICE], s_device_buf, DEVICE_MAX_WIDTH, 2, TIME_FONT, 6);
+    marquee_region_init(&s_regions[REGION_TITLE], s_title_buf, REGION_MAX_WIDTH, 3, TRACK_NAME_FONT, 26);
+    marquee_region_init(&s_regions[REGION_ARTISTS], s_artists_buf, REGION_MAX_WIDTH, 2, MENU_FONT, 41);
+    marquee_region_init(&s_regions[REGION_ALBUM], s_album_buf, REGION_MAX_WIDTH, 2, MENU_FONT, 53);
+    for (uint8_t region = 0; region < NOW_PLAYING_REGIONS; region++)
+        marquee_region_clip(&s_regions[region], ROWS[region][0], ROWS[region][1]);
+    marquee_init(marquee, &s_u8g2, s_regions, NOW_PLAYING_REGIONS);
+}
 
-    const char* sl = "change volume\nartist\nqueue\nBack\nMain Menu";
+/**
+ * @brief Give the regions whose text is in changes (track_change_t bits)
+ * the text of the published track. The others keep their strips as they are.
+ *
+ */
+static void now_playing_set_texts(marquee_t* marquee, uint16_t changes)
+{
+    static const uint16_t REGION_CHANGES[NOW_PLAYING_REGIONS] = {
+        [REGION_DEVICE] = TRACK_CHANGED_DEVICE,
+        [REGION_TITLE] = TRACK_CHANGED_TITLE,
+        [REGION_ARTISTS] = TRACK_CHANGED_ARTISTS,
+        [REGION_ALBUM] = TRACK_CHANGED_ALBUM,
+    };
+    char text[TRACK_TEXT_MAX];
+    bool set = false;
+
+    for (uint8_t region = 0; region < NOW_PLAYING_REGIONS; region++) {
+        if (!(changes & REGION_CHANGES[region]))
+            continue;
+        read_track_text(region, text, sizeof(text));
+        marquee_set_text(marquee, region, text);
+        set = true;
+    }
+    if (set)
+        log_glyph_cache();
+}
 
-    u8g2_SetFont(&s_u8g2, MENU_FONT);
+/**
+ * @brief Copy the text of a region from the published track. The player
+ * task never waits for it: if the track is rewritten meanwhile, it's read
+ * again.
+ *
+ */
+static void read_track_text(uint8_t region, char* out, size_t size)
+{
+    const TrackInfo* track;
+    uint32_t         seq;
 
     do {
-        selection = userInterfaceSelectionList(&s_u8g2, encoder,
-            "Track options", selection,
-            sl, portMAX_DELAY);
-        switch (selection) {
-        case 1:
-            return change_volume_page();
-        case 2:
-            /* code */
+        track = track_read_begin(&seq);
+        const char* str = NULL;
+        switch (region) {
+        case REGION_DEVICE:
+            str = track->device.name;
             break;
-        case 3:
-            /* code */
+        case REGION_TITLE:
+            str = track->name;
             break;
-        case 4:
-            return now_playing_page();
-        case 5:
-            return initial_menu_page();
-        default:
+        case REGION_ARTISTS:
+            join_artists(track, out, size);
+            continue;
+        case REGION_ALBUM:
+            str = track->album;
             break;
         }
-
-    } while (1);
+        /* bounded: the string may be unterminated until validated */
+        strncpy(out, str ? str : "", size - 1);
+        out[size - 1] = '\0';
+    } while (track_read_retry(seq));
 }
 
-static void available_devices_page()
+/**
+ * @brief Artists of the track separated by commas. The artists that don't
+ * fit in out are left out.
+ *
+ */
+static void join_artists(const TrackInfo* track, char* out, size_t size)
 {
-    DRAW_STR_CLR(0, 20, NOTIF_FONT, "Retrieving available devices...");
-    uint8_t selection;
-update_list:
-    selection = 1;
+    size_t   len = 0;
+    uint16_t count = track->artists.count < MAX_ARTISTS ? track->artists.count : MAX_ARTISTS;
+
+    out[0] = '\0';
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t    name_len;
+        const char* name = strTableGet(&track->artists, i, &name_len);
+        int         n = snprintf(out + len, size - len, "%s%.*s", i ? ", " : "", name_len, name);
+        if (n < 0 || (size_t)n >= size - len) {
+            out[len] = '\0'; /* don't leave half a name */
+            break;
+        }
+        len += n;
+    }
+}
 
-    http_available_devices();
-    uint32_t notif;
-    xTaskNotifyWait(0, ULONG_MAX, &notif, portMAX_DELAY);
+static void log_glyph_cache()
+{
+    unifont_stats_t stats;
 
-    if (notif == ACTIVE_DEVICES_FOUND) {
-        u8g2_SetFont(&s_u8g2, MENU_FONT);
-        selection = userInterfaceSelectionList(&s_u8g2, encoder,
-            "Select a device", selection,
-            DEVICES.items_string,
-            pdMS_TO_TICKS(10000));
+    unifont_stats(&stats);
+    if (stats.lookups) {
+        ESP_LOGD(TAG, "Glyph cache: %u lookups, %u%% hits, %u flash reads",
+            stats.lookups, stats.hits * 100 / stats.lookups, stats.flash_reads);
+    }
+}
 
-        if (selection == MENU_EVENT_TIMEOUT)
-            goto cleanup;
+/**
+ * @brief Item source of a selection list over a StrTable, ctx is the table.
+ *
+ */
+static const char* str_table_item(void* ctx, uint16_t index, uint16_t* len)
+{
+    return strTableGet(ctx, index, len);
+}
 
-        StrListItem* device = DEVICES.values.first;
+static page_id_t track_menu_update()
+{
+    return menu_update(&TRACK_MENU);
+}
+static void devices_enter()
+{
+    DRAW_STR_CLR(0, 20, NOTIF_FONT, "Retrieving available devices...");
+}
 
-        for (uint16_t i = 1; i < selection; i++) {
-            device = device->next;
-        }
+/**
+ * @brief The list is fetched again when nothing is selected within 10 s.
+ *
+ */
+static page_id_t devices_update()
+{
+    page_id_t       next = PAGE_NOW_PLAYING; // TODO: make dynamic
+    display_event_t event;
 
-        ESP_LOGI(TAG, "DEVICE ID: %s", device->str);
+    if (!fetch_list(&s_devices, &event))
+        return PAGE_MAIN_MENU;
 
-        http_set_device(device->str);
-        u8g2_SetFont(&s_u8g2, NOTIF_FONT);
-        xTaskNotifyWait(0, ULONG_MAX, &notif, portMAX_DELAY);
-        u8g2_ClearBuffer(&s_u8g2);
+    if (event.type == DEVICES_TIMED_OUT || event.type == DEVICES_FAILED) {
+        next = PAGE_MAIN_MENU;
+    } else if (event.type == ACTIVE_DEVICES_FOUND) {
+        u8g2_SetFont(&s_u8g2, MENU_FONT);
+        sl_source_t source = { str_table_item, &DEVICES.names, DEVICES.names.count };
+        uint16_t    selection = userInterfaceSelectionListSource(&s_u8g2, &s_input,
+            "Select a device", 1, &source,
+            pdMS_TO_TICKS(10000));
 
-        if (notif == PLAYBACK_TRANSFERRED_OK) {
-            u8g2_DrawStr(&s_u8g2, 0, 20, "Playback transferred to device");
-        } else if (notif == PLAYBACK_TRANSFERRED_FAIL) {
-            u8g2_DrawStr(&s_u8g2, 0, 20, "Device failed");
+        if (selection == MENU_EVENT_TIMEOUT) {
+            next = PAGE_STAY;
+        } else if (selection == 0) {
+            next = PAGE_MAIN_MENU;
+        } else {
+            uint16_t    id_len;
+            const char* device_id = strTableGet(&DEVICES.values, selection - 1, &id_len);
+
+            ESP_LOGI(TAG, "DEVICE ID: %.*s", id_len, device_id);
+
+            drain_client_events(NULL); /* room for the answer */
+            http_set_device(device_id, id_len);
+            list_cache_drop(&s_devices); /* the active device changed */
+
+            if (!read_client_answer(&event, PLAYBACK_TRANSFERRED_OK, PLAYBACK_TRANSFERRED_FAIL,
+                    pdMS_TO_TICKS(TRANSFER_TIMEOUT_MS))) {
+                ESP_LOGW(TAG, "No answer to the playback transfer");
+                overlay_show_text("Device failed", TOAST_MS);
+            } else if (event.type == PLAYBACK_TRANSFERRED_OK) {
+                overlay_show_text("Playback transferred to device", TOAST_MS);
+            } else {
+                overlay_show_text("Device failed", TOAST_MS);
+            }
         }
-        u8g2_SendBuffer(&s_u8g2);
-        vTaskDelay(pdMS_TO_TICKS(3000));
 
-    } else if (notif == NO_ACTIVE_DEVICES) {
-        DRAW_STR_CLR(0, 20, NOTIF_FONT, "No devices found :c");
-        vTaskDelay(pdMS_TO_TICKS(3000));
+    } else if (event.type == NO_ACTIVE_DEVICES) {
+        overlay_show_text("No devices found :c", TOAST_MS);
     }
 
-cleanup:
-    if (DEVICES.items_string) {
-        free(DEVICES.items_string);
-        DEVICES.items_string = NULL;
-    }
-    strListClear(&DEVICES.values);
+    return next;
+}
+static void volume_enter()
+{
+    const TrackInfo* track;
+    uint32_t         seq;
+    char             volume[sizeof(track->device.volume_percent)];
 
-    if (selection == MENU_EVENT_TIMEOUT)
-        goto update_list;
-    return now_playing_page(); // TODO: make dynamic
+    ENABLE_PLAYER_TASK;
+    do {
+        track = track_read_begin(&seq);
+        memcpy(volume, track->device.volume_percent, sizeof(volume));
+    } while (track_read_retry(seq));
+    volume[sizeof(volume) - 1] = '\0';
+
+    s_volume.level = atoi(volume);
+    s_volume.unsent = false;
+    draw_volume_bars(s_volume.level);
 }
 
-static void change_volume_page()
+/**
+ * @brief The level is drawn as soon as the encoder turns. The request is
+ * sent once the encoder rests for VOLUME_DEBOUNCE_MS, in the background.
+ * When nothing is pending, the level follows the one of the server.
+ *
+ */
+static page_id_t volume_update()
 {
-    ENABLE_PLAYER_TASK;
-    int steps = 0;
-    while (1) {
-        uint8_t percent = atoi(TRACK->device.volume_percent);
-        draw_volume_bars(percent);
-        /* Intercept any encoder event -----------------------------------------------*/
-        rotary_encoder_event_t queue_event;
-        if (pdTRUE == xQueueReceive(encoder, &queue_event, 0)) {
-            if (queue_event.event_type == ROTARY_ENCODER_EVENT) {
-                if (queue_event.re_state.direction == ROTARY_ENCODER_DIRECTION_CLOCKWISE) {
-                    steps -= 3;
-                } else {
-                    steps += 3;
-                }
-            } else { /* BUTTON_EVENT intercepted */
-                switch (queue_event.btn_event) {
-                case SHORT_PRESS:
-                    player_cmd(&queue_event);
-                    break;
-                case MEDIUM_PRESS:
-                case LONG_PRESS:
-                    return now_playing_page();
-                    break;
-                }
+    volume_page_t* vol = &s_volume;
+
+    TickType_t wait = portMAX_DELAY;
+    if (vol->unsent) {
+        int32_t left = vol->send_at - xTaskGetTickCount();
+        wait = left > 0 ? left : 0;
+    }
+
+    /* Wait for the encoder or a client event -------------------------------------*/
+
+    input_event_t   input;
+    display_event_t event;
+    wake_t          wake = wait_event(wait, &input, &event);
+
+    if (wake == WAKE_INPUT) {
+        if (input.type == ROTARY_ENCODER_EVENT) {
+            /* clockwise lowers the volume, fast spins take bigger steps */
+            int new_level = vol->level - input.delta * VOLUME_STEP;
+            if (new_level > 100) {
+                new_level = 100;
+            } else if (new_level < 0) {
+                new_level = 0;
             }
-        } else {
-            if (steps != 0) {
-                steps += percent;
-                if (steps > 100) {
-                    steps = 100;
-                } else if (steps < 0) {
-                    steps = 0;
-                }
-                http_update_volume(steps);
-                steps = 0;
+            if (new_level != vol->level) {
+                vol->level = new_level;
+                draw_volume_bars(vol->level);
+            }
+            vol->unsent = true;
+            vol->send_at = xTaskGetTickCount() + pdMS_TO_TICKS(VOLUME_DEBOUNCE_MS);
+        } else { /* BUTTON_EVENT intercepted */
+            switch (input.btn_event) {
+            case SHORT_PRESS:
+                player_cmd(cmdToggle);
+                break;
+            case MEDIUM_PRESS:
+            case LONG_PRESS:
+                if (vol->unsent) /* don't lose the last turns */
+                    http_update_volume_async(vol->level);
+                return PAGE_NOW_PLAYING;
             }
         }
+        return PAGE_STAY;
     }
-}
 
-static void print_message(const char* msg, uint8_t y, const uint8_t* font, uint8_t times)
-{
-    u8g2_SetFont(&s_u8g2, font);
-    msg_info_t msg_info = INIT_MSG_INFO(msg);
-    do {
-        u8g2_ClearBuffer(&s_u8g2);
-        u8g2_DrawUTF8(&s_u8g2, msg_info.offset, y, msg);
-
-        /* When the message doesn't fit on display, the offset is
-         * updated on each iteration to make it scroll */
-        if (msg_info.width > s_u8g2.width) {
-            /* ticks transcurred since reached a flank */
-            TickType_t ticks_on_flank = xTaskGetTickCount() - msg_info.flank_tcount;
-            /* Track can scroll if it exceeds the threshold of being frozen on one edge */
-            if (pdMS_TO_TICKS(1000) < ticks_on_flank) { /* threshold: 1000 ms */
-                if (msg_info.on_right_flank) { /* go to the left flank */
-                    msg_info.on_right_flank = false;
-                    msg_info.offset = 0;
-                    msg_info.flank_tcount = xTaskGetTickCount();
-                } else {
-                    msg_info.offset -= 1; // scroll by one pixel
-                    if ((u8g2_uint_t)msg_info.offset < (u8g2_uint_t)(s_u8g2.width - msg_info.width)) { /* right flank reached */
-                        msg_info.on_right_flank = true;
-                        times--;
-                        msg_info.flank_tcount = xTaskGetTickCount();
-                    }
-                }
-            }
+    /* The encoder rests: send the level ----------------------------------------------*/
+
+    if (vol->unsent && (int32_t)(xTaskGetTickCount() - vol->send_at) >= 0) {
+        http_update_volume_async(vol->level);
+        vol->unsent = false;
+    }
+
+    /* Reconcile with the server once the requests are done -----------------------*/
+
+    if (wake == WAKE_CLIENT && event.type == TRACK_UPDATED
+        && (event.track.changes & TRACK_CHANGED_VOLUME)
+        && !vol->unsent && !http_volume_pending()) {
+        int server_level = event.track.volume_percent;
+        if (server_level != vol->level) {
+            ESP_LOGD(TAG, "Volume reconciled: %d -> %d", vol->level, server_level);
+            vol->level = server_level;
+            draw_volume_bars(vol->level);
         }
-        u8g2_SendBuffer(&s_u8g2);
-        vTaskDelay(pdMS_TO_TICKS(50));
-    } while (times > 0);
+    }
+    return PAGE_STAY;
 }
 
-static void system_menu_page()
+static void print_message(const char* msg, uint8_t y, const uint8_t* font, uint8_t times)
 {
-    uint8_t selection = 1;
+    marquee_region_t region;
+    marquee_t        marquee;
+    TickType_t       now, next;
 
-    u8g2_SetFont(&s_u8g2, MENU_FONT);
+    marquee_region_init(&region, s_title_buf, REGION_MAX_WIDTH, 3, font, y);
+    marquee_init(&marquee, &s_u8g2, &region, 1);
+    marquee_set_text(&marquee, 0, msg);
+    /* the message is done when it reaches the right flank for the last time */
+    TickType_t done = marquee_cycles_end(&marquee, 0, times);
 
     do {
-        selection = userInterfaceSelectionList(&s_u8g2, encoder,
-            "System", selection,
-            "Delete wifi\nRestart\nBack",
-            portMAX_DELAY);
-        switch (selection) {
-        case 1:
-            return delete_wifi_page();
-        case 2:
-            return restart_page();
-        case 3:
-            return initial_menu_page(&s_u8g2);
-        default:
+        now = xTaskGetTickCount();
+        u8g2_ClearBuffer(&s_u8g2);
+        next = marquee_draw(&marquee, now);
+        display_flush(&s_u8g2);
+
+        if (next == RENDER_NO_DEADLINE) /* fits on display, nothing to scroll */
             break;
-        }
-    } while (1);
+        vTaskDelay(next - now);
+    } while ((int32_t)(done - next) >= 0);
 }
 
-static void delete_wifi_page()
+static page_id_t system_menu_update()
+{
+    return menu_update(&SYSTEM_MENU);
+}
+static page_id_t delete_wifi_update()
 {
     /* TODO: add confirmation button */
     int err = wifi_config_delete();
@@ -582,19 +1276,19 @@ static void delete_wifi_page()
         print_message("Error deleting wifi credentials", 35, NOTIF_FONT, 1);
     }
     vTaskDelay(pdMS_TO_TICKS(2000));
-    restart_page();
+    return PAGE_RESTART;
 }
-
-static void restart_page()
+static page_id_t restart_update()
 {
     /* TODO: add confirmation button */
     DRAW_STR_CLR(15, 20, NOTIF_FONT, "Restarting...");
     vTaskDelay(pdMS_TO_TICKS(3000));
     esp_restart();
+    return PAGE_STAY;
 }
-
-static void test_large_msg()
+static page_id_t test_message_update()
 {
     const char* msg = "Hola gente como andan eiii, ajjajaj. Esto mira que puede ser largo";
     print_message(msg, 35, NOTIF_FONT, 1);
+    return PAGE_MAIN_MENU;
 }
\ No newline at end of file
@@ -0,0 +1,275 @@
+/**
+ * @file display_flush.c
+ * @brief The previous frame is kept as a shadow copy. On each flush the
+ * buffer is compared one tile row (8 pixel lines) at a time, and only runs
+ * of changed rows are pushed with u8g2_UpdateDisplayArea(). A frame equal to
+ * the previous one isn't sent at all.
+ *
+ * Sending runs in its own task. display_flush() only copies the frame into
+ * the next buffer and returns, so the caller can compose the following frame
+ * while the previous one is clocked out. When the transfer completes the
+ * buffers are swapped. If several frames are flushed during one transfer,
+ * only the latest is sent.
+ *
+ * The overlay is drawn on the copy of the frame that is sent. The page's
+ * frame is kept apart, so when the overlay changes or expires the frame is
+ * composed again without waiting for the page.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "display_flush.h"
+#include "overlay.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define FRAME_BUFFER_SIZE (128 * 64 / 8)
+#define STATS_PERIOD_MS   1000
+#define FLUSH_TASK_STACK  2048 /* composes the overlay too, see test/target */
+#define FRAME_BIT         (1 << 0) /* a frame was composed */
+#define REFRESH_BIT       (1 << 1) /* compose the last frame again */
+#define ACQUIRE_LOCK(mux) xSemaphoreTake(mux, portMAX_DELAY)
+#define RELEASE_LOCK(mux) xSemaphoreGive(mux)
+
+/* Locally scoped variables --------------------------------------------------*/
+static const char*           TAG = "DISPLAY_FLUSH";
+static uint8_t               s_shadow[FRAME_BUFFER_SIZE]; /* last frame sent */
+static bool                  s_shadow_valid = false;
+static u8x8_msg_cb           s_byte_cb; /* the real byte callback */
+static uint32_t              s_full_frame_bytes = 0; /* cost of a full frame, measured */
+static display_flush_stats_t s_stats, s_window;
+static TickType_t            s_window_start;
+static uint8_t               s_frames[2][FRAME_BUFFER_SIZE];
+static uint8_t*              s_next = s_frames[0]; /* latest frame flushed, not sent yet */
+static uint8_t*              s_tx = s_frames[1]; /* frame being sent */
+static bool                  s_pending = false; /* s_next holds a frame */
+static u8g2_t                s_tx_u8g2; /* copy of the display's u8g2, drawing from s_tx */
+static uint8_t               s_page[FRAME_BUFFER_SIZE]; /* last frame flushed, without overlay */
+static size_t                s_page_size = 0;
+static u8g2_t                s_compose_u8g2; /* copy of the display's u8g2, drawing on s_next */
+static SemaphoreHandle_t     s_lock = NULL; /* guards s_next and s_pending */
+static TaskHandle_t          s_flush_task = NULL;
+
+/* Private function prototypes -----------------------------------------------*/
+static void flush_task(void* arg);
+static void compose(void);
+static void send_frame(u8g2_t* u8g2);
+static void account_frame(uint32_t bytes);
+static uint32_t count_bits(const uint8_t* buf, size_t len);
+
+/* Exported functions --------------------------------------------------------*/
+void display_flush_init(u8x8_msg_cb byte_cb)
+{
+    s_byte_cb = byte_cb;
+    s_shadow_valid = false;
+    s_window_start = xTaskGetTickCount();
+
+    s_lock = xSemaphoreCreateMutex();
+    assert(s_lock && "Error on xSemaphoreCreateMutex()");
+    int res = xTaskCreate(flush_task, "display_flush", FLUSH_TASK_STACK, NULL,
+        uxTaskPriorityGet(NULL), &s_flush_task);
+    assert((res == pdPASS) && "Error creating task");
+}
+
+/**
+ * @brief Queue the frame in u8g2 for sending. Returns without waiting for
+ * the display.
+ *
+ */
+void display_flush(u8g2_t* u8g2)
+{
+    size_t size = (size_t)u8g2_GetBufferTileWidth(u8g2) * 8 * u8g2_GetBufferTileHeight(u8g2);
+
+    assert((size <= FRAME_BUFFER_SIZE) && "Frame buffer bigger than the shadow");
+
+    ACQUIRE_LOCK(s_lock);
+    if (s_tx_u8g2.tile_buf_ptr == NULL) { /* first frame, the display is set up */
+        s_tx_u8g2 = *u8g2;
+        s_compose_u8g2 = *u8g2;
+    }
+    memcpy(s_page, u8g2_GetBufferPtr(u8g2), size);
+    s_page_size = size;
+    compose();
+    RELEASE_LOCK(s_lock);
+
+    xTaskNotify(s_flush_task, FRAME_BIT, eSetBits);
+}
+
+/**
+ * @brief Send the last frame again with the current overlay. Called when
+ * the overlay changes.
+ *
+ */
+void display_flush_refresh(void)
+{
+    if (s_lock == NULL)
+        return;
+
+    ACQUIRE_LOCK(s_lock);
+    bool composed = s_page_size > 0;
+    if (composed)
+        compose();
+    RELEASE_LOCK(s_lock);
+
+    if (composed)
+        xTaskNotify(s_flush_task, FRAME_BIT, eSetBits);
+}
+
+/**
+ * @brief Like display_flush_refresh(), but the frame is composed by the
+ * flush task. Never blocks, so it can be called from a timer callback.
+ *
+ */
+void display_flush_request_refresh(void)
+{
+    if (s_flush_task != NULL)
+        xTaskNotify(s_flush_task, REFRESH_BIT, eSetBits);
+}
+
+/**
+ * @brief Forget the shadow copy, so the next flush sends the whole frame.
+ * Needed when something else wrote to the display.
+ *
+ */
+void display_flush_invalidate(void)
+{
+    s_shadow_valid = false;
+}
+
+void display_flush_stats(display_flush_stats_t* stats)
+{
+    *stats = s_stats;
+    stats->stack_unused = uxTaskGetStackHighWaterMark(s_flush_task);
+}
+
+/**
+ * @brief Wraps the real byte callback to count the bytes clocked out.
+ *
+ */
+uint8_t display_flush_byte_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr)
+{
+    if (msg == U8X8_MSG_BYTE_SEND) {
+        s_stats.bytes_sent += arg_int;
+    }
+    return s_byte_cb(u8x8, msg, arg_int, arg_ptr);
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void flush_task(void* arg)
+{
+    uint32_t bits;
+
+    while (1) {
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+
+        ACQUIRE_LOCK(s_lock);
+        if ((bits & REFRESH_BIT) && s_page_size > 0)
+            compose();
+        if (!s_pending) {
+            RELEASE_LOCK(s_lock);
+            continue;
+        }
+        /* swap: the latest frame goes out, its buffer takes the next one */
+        uint8_t* tmp = s_tx;
+        s_tx = s_next;
+        s_next = tmp;
+        s_pending = false;
+        s_tx_u8g2.tile_buf_ptr = s_tx;
+        RELEASE_LOCK(s_lock);
+
+        send_frame(&s_tx_u8g2);
+    }
+    assert(false && "Unexpected exit of infinite task loop");
+}
+
+/**
+ * @brief Next frame = page frame + overlay. Must hold s_lock.
+ *
+ */
+static void compose(void)
+{
+    if (s_pending)
+        s_stats.frames_coalesced++;
+    memcpy(s_next, s_page, s_page_size);
+    s_compose_u8g2.tile_buf_ptr = s_next;
+    overlay_draw(&s_compose_u8g2);
+    s_pending = true;
+}
+
+static void send_frame(u8g2_t* u8g2)
+{
+    uint8_t* buf = u8g2_GetBufferPtr(u8g2);
+    uint8_t  tile_rows = u8g2_GetBufferTileHeight(u8g2);
+    uint8_t  tile_cols = u8g2_GetBufferTileWidth(u8g2);
+    size_t   row_size = (size_t)tile_cols * 8;
+    uint32_t sent_before = s_stats.bytes_sent;
+
+    s_stats.pixels_drawn += count_bits(buf, row_size * tile_rows);
+    if (!s_shadow_valid) {
+        u8g2_SendBuffer(u8g2);
+        memcpy(s_shadow, buf, row_size * tile_rows);
+        s_shadow_valid = true;
+        s_full_frame_bytes = s_stats.bytes_sent - sent_before;
+        account_frame(s_full_frame_bytes);
+        return;
+    }
+
+    uint8_t run_start = 0, run_len = 0;
+    for (uint8_t row = 0; row <= tile_rows; row++) {
+        bool dirty = row < tile_rows
+            && memcmp(s_shadow + row * row_size, buf + row * row_size, row_size);
+        if (dirty) {
+            if (run_len == 0)
+                run_start = row;
+            run_len++;
+            continue;
+        }
+        if (run_len) { /* a run of dirty rows just ended */
+            u8g2_UpdateDisplayArea(u8g2, 0, run_start, tile_cols, run_len);
+            memcpy(s_shadow + run_start * row_size, buf + run_start * row_size, run_len * row_size);
+            run_len = 0;
+        }
+    }
+    account_frame(s_stats.bytes_sent - sent_before);
+}
+
+static void account_frame(uint32_t bytes)
+{
+    s_stats.frames++;
+    s_stats.bytes_full += s_full_frame_bytes;
+    if (bytes == 0)
+        s_stats.frames_skipped++;
+
+    TickType_t elapsed = xTaskGetTickCount() - s_window_start;
+    if (elapsed >= pdMS_TO_TICKS(STATS_PERIOD_MS)) {
+        uint32_t ms = pdTICKS_TO_MS(elapsed);
+        ESP_LOGD(TAG, "%u frames (%u skipped, %u coalesced), %u pixels drawn, bytes/s: %u sent, %u with full refresh, "
+                      "stack: %u bytes never used",
+            s_stats.frames - s_window.frames,
+            s_stats.frames_skipped - s_window.frames_skipped,
+            s_stats.frames_coalesced - s_window.frames_coalesced,
+            s_stats.pixels_drawn - s_window.pixels_drawn,
+            (s_stats.bytes_sent - s_window.bytes_sent) * 1000 / ms,
+            (s_stats.bytes_full - s_window.bytes_full) * 1000 / ms,
+            uxTaskGetStackHighWaterMark(NULL));
+        s_window = s_stats;
+        s_window_start = xTaskGetTickCount();
+    }
+}
+
+/* pixels set in buf */
+static uint32_t count_bits(const uint8_t* buf, size_t len)
+{
+    uint32_t count = 0;
+
+    for (size_t i = 0; i < len; i++)
+        count += __builtin_popcount(buf[i]);
+    return count;
+}
@@ -1,4 +1,5 @@
 /* Includes ------------------------------------------------------------------*/
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -13,21 +14,20 @@
 #include "spotifyclient.h"
 
 /* Private macro -------------------------------------------------------------*/
-#define MATCH_KEY(data, str, left)    \
-    strncpy(http_buffer, data, left); \
-    http_buffer[left] = '\0';         \
-    char* tmp = data;                 \
-    data = strstr(data, str);         \
-    assert(data && "key missing");    \
-    data += strlen(str);              \
-    left -= (data - tmp);
-
 #define MATCH_CHAR(data, ch, left)                                 \
     if (END_REACHED == skip_blanks(&data, &left) || *data != ch) { \
         assert(false && "Char expected not found");                \
     }                                                              \
     data++, left--;
 
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME        16777619u
+#define DIGEST_KEY_MAX   12
+
+/* Levels whose members are tracked: the document itself and the item */
+#define TRACKED_LEVEL(scan) \
+    ((scan).depth == 1 || ((scan).depth == 2 && (scan).hashing == KEY_ITEM))
+
 /* Private types -------------------------------------------------------------*/
 typedef union {
     struct {
@@ -35,6 +35,7 @@ typedef union {
         uint32_t empty       : 1; /*!< Empty playlist array */
         uint32_t get_new_obj : 1; /*!< Go get a new object */
         uint32_t finished    : 1; /*!< We're done */
+        uint32_t failed      : 1; /*!< The rest is ignored, see match_key() */
     };
     uint32_t val; /*!< union fill */
 } json_state_t;
@@ -44,38 +45,74 @@ typedef enum {
     CHAR_DETECTED,
 } match_result_t;
 
+typedef enum {
+    KEY_OTHER,
+    KEY_ITEM,
+    KEY_DEVICE,
+    KEY_PROGRESS,
+    KEY_IS_PLAYING,
+    KEY_URI,
+} digest_key_t;
+
+/* State of the scanner that digests the top level members of the player
+ * document. It only tracks nesting and strings, it doesn't tokenize */
+typedef struct {
+    player_digest_t digest;
+    uint32_t        hash; /*!< Running hash of the object being digested */
+    digest_key_t    key; /*!< Member of the document whose value is being read */
+    digest_key_t    item_key; /*!< Member of the item whose value is being read */
+    digest_key_t    hashing; /*!< Member whose object is being hashed */
+    uint8_t         depth;
+    uint8_t         key_len;
+    uint8_t         uri_len;
+    char            key_buf[DIGEST_KEY_MAX];
+    bool            in_string : 1;
+    bool            escaped   : 1;
+    bool            expect_key : 1;
+} digest_scanner_t;
+
 /* Private variables ---------------------------------------------------------*/
-static int         s_output_len; // Stores number of bytes read
 static int         s_curly_braces;
+static digest_scanner_t s_scan;
+static player_digest_t  s_last_digest;
+static spotify_client_event_t s_playlists_result = PLAYLISTS_FAILED;
 static const char* TAG = "HANDLER_CALLBACKS";
 
 /* External variables --------------------------------------------------------*/
 
 /* Private function prototypes -----------------------------------------------*/
 match_result_t static skip_blanks(char** ptr, int* left);
+static bool           match_key(request_arena_t* req, char** data, int* left, const char* key);
+static void           digest_feed(const char* data, int len);
+static digest_key_t   digest_lookup_key(const char* key, uint8_t len);
 
 /* Exported functions --------------------------------------------------------*/
-void default_http_event_handler(char* http_buffer, esp_http_client_event_t* evt)
+void default_http_event_handler(request_arena_t* req, esp_http_client_event_t* evt)
 {
+    char* http_buffer = req->buffer;
+
     switch (evt->event_id) {
     case HTTP_EVENT_ON_DATA:
-        if ((s_output_len + evt->data_len) > MAX_HTTP_BUFFER) {
-            ESP_LOGE(TAG, "Not enough space on http_buffer. Ignoring incoming data.");
+        if ((req->received + evt->data_len) > req->buffer_size) {
+            ESP_LOGE(TAG, "Not enough space on http_buffer (%s). Ignoring incoming data.", req->budget->name);
             return;
         }
-        memcpy(http_buffer + s_output_len, evt->data, evt->data_len);
-        s_output_len += evt->data_len;
+        memcpy(http_buffer + req->received, evt->data, evt->data_len);
+        req->received += evt->data_len;
         break;
     case HTTP_EVENT_ON_FINISH:
-        http_buffer[s_output_len] = 0;
-        s_output_len = 0;
+        http_buffer[req->received] = 0;
+        req->body_len = req->received;
+        if (req->received > req->buffer_used)
+            req->buffer_used = req->received;
+        req->received = 0;
         break;
     case HTTP_EVENT_DISCONNECTED:;
         int       mbedtls_err = 0;
         esp_err_t err = esp_tls_get_and_clear_last_error(evt->data, &mbedtls_err, NULL);
         if (err != 0) {
-            http_buffer[s_output_len] = 0;
-            s_output_len = 0;
+            http_buffer[req->received] = 0;
+            req->received = 0;
             ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
             ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
         }
@@ -85,27 +122,76 @@ void default_http_event_handler(char* http_buffer, esp_http_client_event_t* evt)
     }
 }
 
+/**
+ * @brief Same as default_http_event_handler(), but also digests the player
+ * document as it arrives. The digest tells if the current track or device
+ * changed since the last poll without having to parse the whole document.
+ *
+ */
+void player_handler(request_arena_t* req, esp_http_client_event_t* evt)
+{
+    switch (evt->event_id) {
+    case HTTP_EVENT_ON_DATA:
+        if (req->received == 0) { /* first chunk */
+            s_scan = (digest_scanner_t) { 0 };
+        }
+        digest_feed(evt->data, evt->data_len);
+        break;
+    case HTTP_EVENT_ON_FINISH:
+        s_last_digest = s_scan.digest;
+        break;
+    default:
+        break;
+    }
+    default_http_event_handler(req, evt);
+}
+
+void player_handler_digest(player_digest_t* digest)
+{
+    *digest = s_last_digest;
+}
+
+/**
+ * @brief The answer of the last playlists request: PLAYLISTS_OK,
+ * PLAYLISTS_EMPTY, or PLAYLISTS_FAILED if it failed or didn't finish. The
+ * caller notifies the display, with the generation of the fetch.
+ *
+ */
+spotify_client_event_t playlists_handler_result(void)
+{
+    return s_playlists_result;
+}
+
 /**
  * @brief We don't have enough memory to store the whole JSON. So the
  * approach is to process the "items" array one playlist at a time.
  *
  */
-void playlists_handler(char* http_buffer, esp_http_client_event_t* evt)
+void playlists_handler(request_arena_t* req, esp_http_client_event_t* evt)
 {
+    char* http_buffer = req->buffer;
+
     static json_state_t s_state = { { true, false, true, false } };
 
     char* data = (char*)evt->data;
     int   left = evt->data_len;
 
     switch (evt->event_id) {
+    case HTTP_EVENT_HEADERS_SENT: /* a new request, the last one may have been aborted */
+        s_state.val = 5; // reset state (true, false, true, false)
+        s_playlists_result = PLAYLISTS_FAILED;
+        break;
     case HTTP_EVENT_ON_DATA:
-        if (s_state.empty || s_state.finished)
+        if (s_state.empty || s_state.finished || s_state.failed)
             return;
 
         if (s_state.first_chunk) {
             s_state.first_chunk = false;
 
-            MATCH_KEY(data, "\"items\"", left);
+            if (!match_key(req, &data, &left, "\"items\"")) {
+                s_state.failed = true;
+                return;
+            }
             MATCH_CHAR(data, ':', left);
             MATCH_CHAR(data, '[', left);
             // TODO: revise
@@ -124,12 +210,13 @@ void playlists_handler(char* http_buffer, esp_http_client_event_t* evt)
                 ESP_LOGE(TAG, "'{' expected. Got: '%c' instead", *data);
                 assert(false);
             }
-            s_output_len = s_curly_braces = 0;
+            req->received = s_curly_braces = 0;
             s_state.get_new_obj = false;
         }
 
         do {
-            http_buffer[s_output_len++] = *data;
+            assert((req->received < req->buffer_size) && "Playlist object too big");
+            http_buffer[req->received++] = *data;
             if (*data == '{') {
                 s_curly_braces++;
             } else if (*data == '}') {
@@ -139,7 +226,9 @@ void playlists_handler(char* http_buffer, esp_http_client_event_t* evt)
         } while (left > 0 && s_curly_braces > 0);
 
         if (s_curly_braces == 0) {
-            parse_playlist(http_buffer, s_output_len);
+            if (req->received > req->buffer_used)
+                req->buffer_used = req->received;
+            parse_playlist(req, req->received);
             if (CHAR_DETECTED == skip_blanks(&data, &left)) {
                 if (*data == ',') {
                     data++, left--;
@@ -155,10 +244,16 @@ void playlists_handler(char* http_buffer, esp_http_client_event_t* evt)
         }
         break;
     case HTTP_EVENT_ON_FINISH: // is it always called? even when an error or disconnect event occurs?
+        if (s_state.failed) {
+            req->received = 0;
+            s_state.val = 5;
+            s_playlists_result = PLAYLISTS_FAILED;
+            break;
+        }
         assert(s_state.finished && "Error, incomplete json. More character/s expected");
-        s_output_len = 0;
+        req->received = 0;
+        s_playlists_result = s_state.empty ? PLAYLISTS_EMPTY : PLAYLISTS_OK;
         s_state.val = 5; // reset state (true, false, true, false)
-        s_state.empty ? NOTIFY_DISPLAY(PLAYLISTS_EMPTY) : NOTIFY_DISPLAY(PLAYLISTS_OK);
         break;
     default:
         break;
@@ -166,12 +261,162 @@ void playlists_handler(char* http_buffer, esp_http_client_event_t* evt)
 }
 
 /* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Move data past key, searched in the chunk. The chunk is copied to
+ * the request buffer to be null terminated.
+ *
+ * @retval false if the chunk doesn't fit the buffer or key isn't in it
+ */
+static bool match_key(request_arena_t* req, char** data, int* left, const char* key)
+{
+    if (*left > req->buffer_size) {
+        ESP_LOGE(TAG, "%s: chunk of %d bytes too big", req->budget->name, *left);
+        return false;
+    }
+    memcpy(req->buffer, *data, *left);
+    req->buffer[*left] = '\0';
+
+    char* found = strstr(req->buffer, key);
+    if (!found) {
+        ESP_LOGE(TAG, "%s: key %s missing", req->budget->name, key);
+        return false;
+    }
+    found += strlen(key);
+    *left -= found - req->buffer;
+    *data += found - req->buffer;
+    return true;
+}
+
+static void digest_feed(const char* data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
+
+        /* closing brackets are hashed below, once the nesting is updated */
+        if (s_scan.hashing && (s_scan.in_string || (c != '}' && c != ']'))) {
+            s_scan.hash = (s_scan.hash ^ (uint8_t)c) * FNV_PRIME;
+        }
+
+        if (s_scan.in_string) {
+            if (s_scan.escaped) {
+                s_scan.escaped = false;
+            } else if (c == '\\') {
+                s_scan.escaped = true;
+                continue;
+            } else if (c == '"') {
+                s_scan.in_string = false;
+                if (TRACKED_LEVEL(s_scan) && s_scan.expect_key) {
+                    digest_key_t key = digest_lookup_key(s_scan.key_buf, s_scan.key_len);
+                    if (s_scan.depth == 1) {
+                        s_scan.key = key;
+                    } else {
+                        s_scan.item_key = key;
+                    }
+                }
+                continue;
+            }
+            if (!TRACKED_LEVEL(s_scan)) {
+                continue;
+            }
+            if (s_scan.expect_key) {
+                if (s_scan.key_len < DIGEST_KEY_MAX) {
+                    s_scan.key_buf[s_scan.key_len++] = c;
+                }
+            } else if (s_scan.depth == 2 && s_scan.item_key == KEY_URI
+                && s_scan.uri_len < sizeof(s_scan.digest.item_uri) - 1) {
+                s_scan.digest.item_uri[s_scan.uri_len++] = c;
+            }
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            s_scan.in_string = true;
+            s_scan.key_len = 0;
+            break;
+        case '{':
+        case '[':
+            s_scan.depth++;
+            s_scan.expect_key = (c == '{');
+            if (s_scan.depth == 2 && (s_scan.key == KEY_ITEM || s_scan.key == KEY_DEVICE)) {
+                s_scan.hashing = s_scan.key;
+                s_scan.hash = (FNV_OFFSET_BASIS ^ (uint8_t)c) * FNV_PRIME;
+            }
+            break;
+        case '}':
+        case ']':
+            if (s_scan.hashing) {
+                s_scan.hash = (s_scan.hash ^ (uint8_t)c) * FNV_PRIME;
+            }
+            if (--s_scan.depth == 1 && s_scan.hashing) {
+                if (s_scan.hashing == KEY_ITEM) {
+                    s_scan.digest.item_hash = s_scan.hash;
+                } else {
+                    s_scan.digest.device_hash = s_scan.hash;
+                }
+                s_scan.hashing = KEY_OTHER;
+            }
+            break;
+        case ':':
+            if (TRACKED_LEVEL(s_scan)) {
+                s_scan.expect_key = false;
+                if (s_scan.depth == 1 && s_scan.key == KEY_PROGRESS) {
+                    s_scan.digest.progress_ms = 0;
+                }
+            }
+            break;
+        case ',':
+            if (TRACKED_LEVEL(s_scan)) {
+                s_scan.expect_key = true;
+                if (s_scan.depth == 1) {
+                    s_scan.key = KEY_OTHER;
+                } else {
+                    s_scan.item_key = KEY_OTHER;
+                }
+            }
+            break;
+        default:
+            if (s_scan.depth != 1 || s_scan.expect_key) {
+                break;
+            }
+            if (s_scan.key == KEY_PROGRESS && isdigit((unsigned char)c)) {
+                s_scan.digest.progress_ms = s_scan.digest.progress_ms * 10 + (c - '0');
+            } else if (s_scan.key == KEY_IS_PLAYING && (c == 't' || c == 'f')) {
+                s_scan.digest.is_playing = (c == 't');
+                s_scan.key = KEY_OTHER; /* only the first letter matters */
+            }
+            break;
+        }
+    }
+}
+
+static digest_key_t digest_lookup_key(const char* key, uint8_t len)
+{
+    static const struct {
+        const char*  name;
+        digest_key_t key;
+    } keys[] = {
+        { "item", KEY_ITEM },
+        { "device", KEY_DEVICE },
+        { "progress_ms", KEY_PROGRESS },
+        { "is_playing", KEY_IS_PLAYING },
+        { "uri", KEY_URI },
+    };
+
+    for (uint8_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strlen(keys[i].name) == len && !strncmp(keys[i].name, key, len)) {
+            return keys[i].key;
+        }
+    }
+    return KEY_OTHER;
+}
+
 match_result_t static skip_blanks(char** ptr, int* left)
 {
     while (*left >= 0) {
         if (!isspace((unsigned char)**ptr)) // isspace expects an integer, the value of which can fit in an unsigned char
             return CHAR_DETECTED;
-        s_output_len++;
         (*left)--, (*ptr)++;
     }
     return END_REACHED;
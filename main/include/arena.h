@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Bump allocator over a caller provided buffer. Allocations are never freed
+ * one by one, the whole arena is released at once with arena_reset() */
+typedef struct {
+    uint8_t* base; /*!< Backing buffer */
+    size_t   size; /*!< Size of the backing buffer */
+    size_t   used; /*!< Bytes handed out since the last reset */
+} arena_t;
+
+/* Exported macro ------------------------------------------------------------*/
+#define ARENA_ALIGN sizeof(void*)
+/* Worst case size taken by an allocation of n bytes, alignment included */
+#define ARENA_SIZEOF(n) ((((n) + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN)
+
+/* Exported functions prototypes ---------------------------------------------*/
+void  arena_init(arena_t* arena, void* buf, size_t size);
+void* arena_alloc(arena_t* arena, size_t size);
+char* arena_strndup(arena_t* arena, const char* str, size_t len);
+
+static inline void arena_reset(arena_t* arena)
+{
+    arena->used = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
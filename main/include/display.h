@@ -20,17 +20,35 @@ extern "C" {
 #include "freertos/queue.h"
 #include "freertos/task.h"
 
+#include "spotifyclient.h"
+
 /* Exported types ------------------------------------------------------------*/
+typedef struct {
+    spotify_client_event_t type;
+    union {
+        struct {
+            uint16_t changes; /*!< track_change_t bits */
+            time_t   progress_ms;
+            time_t   duration_ms;
+            bool     is_playing;
+            uint8_t  volume_percent;
+        } track; /*!< TRACK_UPDATED: what changed and the new playback state */
+        uint32_t generation; /*!< Answer to a list fetch: the generation it was asked with */
+    };
+} display_event_t;
 
 /* Globally scoped variables declarations ------------------------------------*/
 extern TaskHandle_t DISPLAY_TASK;
 
 /* Exported macro ------------------------------------------------------------*/
-#define NOTIFY_DISPLAY(event) xTaskNotify(DISPLAY_TASK, event, eSetBits)
+#define NOTIFY_DISPLAY(event) display_post(&(display_event_t) { .type = (event) })
+#define NOTIFY_DISPLAY_LIST(event, gen) \
+    display_post(&(display_event_t) { .type = (event), .generation = (gen) })
 
 /* Exported functions prototypes ---------------------------------------------*/
 void display_init(UBaseType_t priority, QueueHandle_t encoder_queue_hlr);
 void send_err(const char* msg);
+bool display_post(const display_event_t* event);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,40 @@
+/**
+ * @file display_flush.h
+ * @brief Sends the u8g2 frame buffer to the display, but only the tile rows
+ * that changed since the previous frame. Frames are sent by a separate task,
+ * so flushing doesn't wait for the display.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "u8g2.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct {
+    uint32_t frames; /*!< Frames flushed */
+    uint32_t frames_skipped; /*!< Frames identical to the previous one */
+    uint32_t frames_coalesced; /*!< Frames replaced by a newer one before being sent */
+    uint32_t pixels_drawn; /*!< Pixels set in the frames sent */
+    uint32_t bytes_sent; /*!< Bytes actually clocked out */
+    uint32_t bytes_full; /*!< Bytes a full u8g2_SendBuffer() per frame would send */
+    uint32_t stack_unused; /*!< High water mark of the flush task's stack, in bytes */
+} display_flush_stats_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void    display_flush_init(u8x8_msg_cb byte_cb);
+void    display_flush(u8g2_t* u8g2);
+void    display_flush_refresh(void);
+void    display_flush_request_refresh(void);
+void    display_flush_invalidate(void);
+void    display_flush_stats(display_flush_stats_t* stats);
+uint8_t display_flush_byte_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,11 +5,33 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
 #include "esp_http_client.h"
+#include "parseobjects.h"
+#include "request_arena.h"
+#include "spotifyclient.h"
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Summary of a "/me/player" (or "/me/player/currently-playing") document,
+ * computed while it streams in */
+typedef struct {
+    uint32_t item_hash; /*!< FNV-1a of the raw "item" object, 0 if missing or null */
+    uint32_t device_hash; /*!< FNV-1a of the raw "device" object, 0 if missing */
+    time_t   progress_ms;
+    bool     is_playing;
+    char     item_uri[TRACK_URI_MAX]; /*!< Raw "uri" of the item */
+} player_digest_t;
 
 /* Exported functions prototypes ---------------------------------------------*/
-void default_http_event_handler(char* http_buffer, esp_http_client_event_t* evt);
-void playlists_handler(char* http_buffer, esp_http_client_event_t* evt);
+void default_http_event_handler(request_arena_t* req, esp_http_client_event_t* evt);
+void player_handler(request_arena_t* req, esp_http_client_event_t* evt);
+void player_handler_digest(player_digest_t* digest);
+void playlists_handler(request_arena_t* req, esp_http_client_event_t* evt);
+spotify_client_event_t playlists_handler_result(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,59 @@
+/**
+ * @file input.h
+ * @brief Reads the rotary encoder queue. Detents queued while a page was
+ * busy come out as a single rotation, and fast spins are accelerated, so a
+ * page redraws once per burst instead of once per detent.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "rotary_encoder.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct {
+    event_type_t type; /*!< ROTARY_ENCODER_EVENT or BUTTON_EVENT */
+    union {
+        struct {
+            int16_t  delta; /*!< Steps to move, accelerated. Clockwise is positive */
+            uint16_t detents; /*!< Detents actually turned */
+            bool     new_gesture; /*!< First rotation after the encoder rested */
+        };
+        button_event_t btn_event;
+    };
+} input_event_t;
+
+typedef struct {
+    QueueHandle_t          queue;
+    QueueSetHandle_t       set; /*!< Set the queue belongs to, or NULL */
+    TickType_t             last_detent; /*!< Tick the last detent was read */
+    uint16_t               rate; /*!< Smoothed detents per second of the current gesture */
+    bool                   held; /*!< A button event was found while draining */
+    rotary_encoder_event_t held_event;
+    void (*other_cb)(void* ctx); /*!< Reads the other members of the set while input_read() waits, or NULL */
+    void*                  other_ctx;
+    /* Statistics */
+    uint32_t               detents;
+    uint32_t               reads; /*!< Rotations returned, each one a redraw at most */
+} input_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void input_init(input_t* input, QueueHandle_t queue, QueueSetHandle_t set);
+bool input_read(input_t* input, input_event_t* event, TickType_t ticks_timeout);
+void input_continue_gesture(input_t* input);
+void input_set_other_cb(input_t* input, void (*cb)(void* ctx), void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
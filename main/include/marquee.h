@@ -0,0 +1,52 @@
+/**
+ * @file marquee.h
+ * @brief Compositor of independent lines of text. Each region has its own
+ * font, position and scroll phase. A region's text is pre-rendered into its
+ * own strip when it changes. On each frame, every region is advanced and
+ * blitted in a single pass.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "freertos/FreeRTOS.h"
+#include "text_strip.h"
+#include "u8g2.h"
+
+/* Exported macro ------------------------------------------------------------*/
+#define MARQUEE_BUF_SIZE TEXT_STRIP_BUF_SIZE
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct {
+    text_strip_t   strip;
+    const uint8_t* font;
+    u8g2_uint_t    baseline;
+    u8g2_uint_t    top; /*!< First display row the region draws on */
+    u8g2_uint_t    bottom; /*!< Row below the last one it draws on */
+    uint32_t       text_hash; /*!< To skip rendering the same text again */
+    TickType_t     start_tick; /*!< Start of the first scroll cycle */
+} marquee_region_t;
+
+typedef struct {
+    u8g2_t*           u8g2;
+    marquee_region_t* regions;
+    uint8_t           count;
+} marquee_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void       marquee_init(marquee_t* marquee, u8g2_t* u8g2, marquee_region_t* regions, uint8_t count);
+void       marquee_region_init(marquee_region_t* region, uint8_t* buf, u8g2_uint_t max_width,
+      uint8_t tile_rows, const uint8_t* font, u8g2_uint_t baseline);
+void       marquee_region_clip(marquee_region_t* region, u8g2_uint_t top, u8g2_uint_t bottom);
+void       marquee_set_text(marquee_t* marquee, uint8_t region, const char* text);
+TickType_t marquee_cycles_end(marquee_t* marquee, uint8_t region, uint8_t cycles);
+TickType_t marquee_draw(marquee_t* marquee, TickType_t now);
+
+#ifdef __cplusplus
+}
+#endif
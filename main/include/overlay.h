@@ -0,0 +1,32 @@
+/**
+ * @file overlay.h
+ * @brief Timed notifications drawn on top of whatever page is shown. The
+ * overlay is composited when a frame is flushed, so pages don't wait for
+ * it, and it disappears by itself when its time is up.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+#include "u8g2.h"
+
+/* Exported macro ------------------------------------------------------------*/
+#define OVERLAY_TEXT_MAX 96
+
+/* Exported functions prototypes ---------------------------------------------*/
+void overlay_init(void);
+void overlay_show_text(const char* text, uint32_t duration_ms);
+void overlay_show_volume(uint8_t percent, uint32_t duration_ms);
+void overlay_hide(void);
+void overlay_draw(u8g2_t* u8g2);
+
+#ifdef __cplusplus
+}
+#endif
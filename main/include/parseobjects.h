@@ -8,10 +8,46 @@ extern "C" {
 #include <stdbool.h>
 #include <time.h>
 
+#include "arena.h"
+#include "request_arena.h"
 #include "strlib.h"
 
+/* Exported macro ------------------------------------------------------------*/
+/* Upper bounds (null terminator included) of the strings stored on a
+ * TrackInfo. Longer values are truncated on a UTF-8 boundary */
+#define TRACK_URI_MAX   128
+#define TRACK_NAME_MAX  256
+#define ALBUM_NAME_MAX  256
+#define ARTIST_NAME_MAX 128
+#define MAX_ARTISTS     8
+#define DEVICE_ID_MAX   64
+#define DEVICE_NAME_MAX 64
+#define DEVICE_TYPE_MAX 32
+
+/* Worst case size of the arena backing a TrackInfo */
+#define TRACK_ARENA_SIZE (ARENA_SIZEOF(TRACK_URI_MAX) + ARENA_SIZEOF(TRACK_NAME_MAX)     \
+    + ARENA_SIZEOF(ALBUM_NAME_MAX)                                                     \
+    + ARENA_SIZEOF(MAX_ARTISTS * ARTIST_NAME_MAX)                                      \
+    + ARENA_SIZEOF(MAX_ARTISTS * sizeof(uint16_t))                                     \
+    + ARENA_SIZEOF(DEVICE_ID_MAX) + ARENA_SIZEOF(DEVICE_NAME_MAX)                      \
+    + ARENA_SIZEOF(DEVICE_TYPE_MAX))
+
 /* Exported types ------------------------------------------------------------*/
 
+/* Differences between two TrackInfo snapshots, see track_info_diff() */
+typedef enum {
+    TRACK_CHANGED_ITEM = 1 << 0, /*!< Another track or episode (uri) */
+    TRACK_CHANGED_TITLE = 1 << 1,
+    TRACK_CHANGED_ARTISTS = 1 << 2,
+    TRACK_CHANGED_ALBUM = 1 << 3,
+    TRACK_CHANGED_PLAY_STATE = 1 << 4, /*!< Playing or paused */
+    TRACK_CHANGED_PROGRESS = 1 << 5, /*!< Progress received from the server */
+    TRACK_CHANGED_SEEK = 1 << 6, /*!< Progress jumped, not just elapsed */
+    TRACK_CHANGED_DEVICE = 1 << 7,
+    TRACK_CHANGED_VOLUME = 1 << 8,
+    TRACK_CHANGED_ALL = (1 << 9) - 1,
+} track_change_t;
+
 typedef struct
 {
     char* id;
@@ -23,13 +59,16 @@ typedef struct
 
 typedef struct
 {
-    char*   name;
-    StrList artists;
-    char*   album;
-    time_t  duration_ms;
-    time_t  progress_ms;
-    bool    isPlaying : 1;
-    Device  device;
+    char*    uri; /*!< Identifies the item, names are not unique */
+    char*    name;
+    StrTable artists; /*!< Fixed table, its storage lives on the arena */
+    char*    album;
+    time_t   duration_ms;
+    time_t   progress_ms;
+    bool     isPlaying : 1;
+    Device   device;
+    arena_t  arena; /*!< Owns every string of the snapshot */
+    uint8_t  arena_buf[TRACK_ARENA_SIZE];
 } TrackInfo;
 
 typedef struct
@@ -41,8 +80,8 @@ typedef struct
 } Tokens;
 
 typedef struct {
-    char*   items_string;
-    StrList values;
+    StrTable names; /*!< What the selection list shows */
+    StrTable values; /*!< Uri or id of each name, same index */
 } u8g2_items_list_t;
 
 /* Globally scoped variables declarations ------------------------------------*/
@@ -51,10 +90,13 @@ extern u8g2_items_list_t DEVICES;
 
 /* Exported functions prototypes ---------------------------------------------*/
 void      init_functions_cb(void);
-void      parseTrackInfo(const char* js, TrackInfo* track);
-void      parseTokens(const char* js, Tokens* tokens);
-void      parse_playlist(const char* js, int output_len);
-esp_err_t parse_available_devices(const char* js);
+void      track_info_init(TrackInfo* track);
+void      track_info_reset(TrackInfo* track);
+uint16_t  track_info_diff(const TrackInfo* old, const TrackInfo* new);
+void      parseTrackInfo(request_arena_t* req, TrackInfo* track);
+void      parseTokens(request_arena_t* req, Tokens* tokens);
+void      parse_playlist(request_arena_t* req, int output_len);
+esp_err_t parse_available_devices(request_arena_t* req);
 
 #ifdef __cplusplus
 }
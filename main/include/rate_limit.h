@@ -0,0 +1,46 @@
+/**
+ * @file rate_limit.h
+ * @brief Token bucket in front of every Web API request, so the device
+ * doesn't burst past the quota of the app credential. Classes of lower
+ * priority leave a reserve of tokens to the higher ones, so a refresh of a
+ * list never delays a user command.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum {
+    RATE_COMMAND, /*!< Play/pause, skip, volume, transfer, token refresh */
+    RATE_POLL, /*!< Player state */
+    RATE_LIST, /*!< Playlists and devices */
+    RATE_CLASSES,
+} rate_class_t;
+
+typedef struct {
+    uint32_t granted[RATE_CLASSES];
+    uint32_t throttled[RATE_CLASSES]; /*!< Requests that had to wait for a token */
+    uint32_t waited_ms[RATE_CLASSES]; /*!< Time spent waiting, summed */
+    uint32_t server_throttled; /*!< 429 answers received anyway */
+} rate_limit_stats_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+bool rate_limit_take(rate_class_t cls, TickType_t* wait);
+void rate_limit_waited(rate_class_t cls, TickType_t ticks);
+void rate_limit_backoff(uint32_t ms);
+bool rate_limit_in_backoff(void);
+void rate_limit_stats(rate_limit_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+/**
+ * @file render_sched.h
+ * @brief Decides when a page has to render a frame: as soon as its state
+ * changes, or when the closest animation deadline arrives. Frames are paced
+ * so rendering never takes more than a fixed share of the CPU.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* Exported macro ------------------------------------------------------------*/
+#define RENDER_NO_DEADLINE portMAX_DELAY
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct {
+    bool       dirty; /*!< State changed, render as soon as possible */
+    TickType_t deadline; /*!< Closest animation deadline, or RENDER_NO_DEADLINE */
+    TickType_t not_before; /*!< Earliest tick for the next frame (CPU budget) */
+    int64_t    frame_start_us;
+    /* Frame time statistics */
+    uint32_t   frames;
+    uint32_t   overruns; /*!< Frames that exceeded the budget */
+    uint32_t   min_us;
+    uint32_t   max_us;
+    uint64_t   total_us;
+    TickType_t stats_since;
+} render_sched_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void       render_sched_init(render_sched_t* sched);
+void       render_sched_invalidate(render_sched_t* sched);
+void       render_sched_request(render_sched_t* sched, TickType_t deadline);
+TickType_t render_sched_wait_ticks(const render_sched_t* sched);
+bool       render_sched_begin_frame(render_sched_t* sched);
+void       render_sched_end_frame(render_sched_t* sched);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "esp_err.h"
+#include "jsmn.h"
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Worst case memory needs of an endpoint, declared once per endpoint. The
+ * peaks are updated each time a request to the endpoint ends */
+typedef struct {
+    const char* name;
+    size_t      buffer_size; /*!< Worst case size of the response body */
+    uint16_t    max_tokens; /*!< Worst case number of json tokens of the response */
+    size_t      post_size; /*!< Worst case size of the payload (or built url) */
+    size_t      buffer_peak; /*!< High water mark of the response body */
+    uint16_t    tokens_peak; /*!< High water mark of the json tokens */
+} request_budget_t;
+
+/* Memory of the request in flight. Everything is carved from a single
+ * block, taken when the request starts and given back when it ends */
+typedef struct {
+    request_budget_t* budget; /*!< Endpoint of the request in flight */
+    char*             buffer; /*!< Response body */
+    size_t            buffer_size;
+    size_t            buffer_used; /*!< Largest body stored during this request */
+    size_t            body_len; /*!< Size of the last complete response body */
+    size_t            received; /*!< Bytes of the body received so far */
+    jsmntok_t*        tokens;
+    uint16_t          max_tokens;
+    uint16_t          tokens_used; /*!< Largest token count parsed during this request */
+    char*             post; /*!< Payload (or built url) */
+    size_t            post_size;
+    arena_t           arena; /*!< Owns the block */
+    size_t            block_peak; /*!< High water mark of the block size */
+} request_arena_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+esp_err_t request_arena_begin(request_arena_t* req, request_budget_t* budget);
+void      request_arena_end(request_arena_t* req, bool keep_block);
+void      request_arena_log(const request_arena_t* req, request_budget_t** budgets, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
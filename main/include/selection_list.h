@@ -7,12 +7,34 @@ extern "C" {
 /* Includes ------------------------------------------------------------------*/
 #include "u8g2.h"
 
+#include "input.h"
+
 /* Exported macro ------------------------------------------------------------*/
-#define MENU_EVENT_TIMEOUT 127
+#define MENU_EVENT_TIMEOUT UINT16_MAX
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Returns item index of the list, not necessarily null terminated, and its
+ * length on len. The string only needs to stay valid until the next call */
+typedef const char* (*sl_item_cb_t)(void* ctx, uint16_t index, uint16_t* len);
+
+/* The cursor rested on item index, e.g. to fetch what it leads to ahead */
+typedef void (*sl_rest_cb_t)(void* ctx, uint16_t index);
+
+typedef struct {
+    sl_item_cb_t item; /*!< Called for each visible item on every redraw */
+    void*        ctx; /*!< Passed to item and rest */
+    uint16_t     count; /*!< Number of items */
+    sl_rest_cb_t rest; /*!< Called once per position held rest_ticks, or NULL */
+    TickType_t   rest_ticks;
+} sl_source_t;
 
 /* Exported functions prototypes ---------------------------------------------*/
-uint8_t userInterfaceSelectionList(u8g2_t* u8g2, QueueHandle_t queue,
-    const char* title, uint8_t start_pos, const char* sl, TickType_t ticks_timeout);
+uint16_t userInterfaceSelectionList(u8g2_t* u8g2, input_t* input,
+    const char* title, uint16_t start_pos, const char* sl, TickType_t ticks_timeout);
+sl_source_t sl_string_source(const char* sl);
+uint16_t userInterfaceSelectionListSource(u8g2_t* u8g2, input_t* input,
+    const char* title, uint16_t start_pos, const sl_source_t* source, TickType_t ticks_timeout);
 
 #ifdef __cplusplus
 }
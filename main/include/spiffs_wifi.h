@@ -1,6 +1,7 @@
 #pragma once
 
 /* Includes ------------------------------------------------------------------*/
+#include "esp_err.h"
 #include "esp_wifi_types.h"
 
 /* Exported macro ------------------------------------------------------------*/
@@ -10,4 +11,6 @@
 /* Exported functions prototypes ---------------------------------------------*/
 int wifi_config_read(wifi_config_t* wifi_config);
 int wifi_config_write(wifi_config_t* wifi_config);
-int wifi_config_delete();
\ No newline at end of file
+int wifi_config_delete();
+esp_err_t spiffs_mount();
+void spiffs_unmount();
\ No newline at end of file
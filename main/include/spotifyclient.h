@@ -22,10 +22,6 @@ extern "C" {
 #include "freertos/task.h"
 
 #include "parseobjects.h"
-#include "rotary_encoder.h"
-
-/* Exported macro ------------------------------------------------------------*/
-#define MAX_HTTP_BUFFER 8192
 
 /* Exported types ------------------------------------------------------------*/
 typedef enum {
@@ -40,8 +36,7 @@ typedef enum {
 } Player_cmd_t;
 
 typedef enum {
-    NEW_TRACK = 1,
-    SAME_TRACK,
+    TRACK_UPDATED = 1,
     PLAYBACK_TRANSFERRED_OK,
     PLAYBACK_TRANSFERRED_FAIL,
     ACTIVE_DEVICES_FOUND,
@@ -49,12 +44,15 @@ typedef enum {
     LAST_DEVICE_FAILED,
     PLAYLISTS_EMPTY,
     PLAYLISTS_OK,
-    VOLUME_CHANGED
+    PLAYLISTS_TIMED_OUT,
+    DEVICES_TIMED_OUT,
+    PLAYLISTS_FAILED, /*!< The fetch couldn't be done, e.g. out of memory */
+    DEVICES_FAILED,
+    PLAYER_STATE_FAILED, /*!< The first poll after the player task was enabled failed */
 } spotify_client_event_t;
 
 /* Exported variables declarations -------------------------------------------*/
 extern TaskHandle_t PLAYER_TASK;
-extern TrackInfo*   TRACK;
 
 /* Exported macro ------------------------------------------------------------*/
 #define ENABLE_PLAYER_TASK  xTaskNotify(PLAYER_TASK, ENABLE_TASK, eSetValueWithOverwrite)
@@ -66,12 +64,19 @@ extern TrackInfo*   TRACK;
 
 /* Exported functions prototypes ---------------------------------------------*/
 void spotify_client_init(UBaseType_t priority);
-void player_cmd(rotary_encoder_event_t* event);
-void http_user_playlists();
-void http_available_devices();
-void http_play_context_uri(const char* uri);
+void player_cmd(Player_cmd_t cmd);
+const TrackInfo* track_read_begin(uint32_t* seq);
+bool track_read_retry(uint32_t seq);
+void http_user_playlists(uint32_t generation);
+void http_available_devices(uint32_t generation);
+void http_user_playlists_async(uint32_t generation);
+void http_available_devices_async(uint32_t generation);
+void http_cancel_background();
+void http_play_context_uri(const char* uri, int uri_len);
 void http_update_volume(int8_t volume_percent);
-void http_set_device(const char* dev_id);
+void http_update_volume_async(uint8_t volume_percent);
+bool http_volume_pending();
+void http_set_device(const char* dev_id, int id_len);
 
 #ifdef __cplusplus
 }
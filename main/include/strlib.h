@@ -2,21 +2,27 @@
 
 #include "esp_err.h"
 #include <stdbool.h>
+#include <stdint.h>
 
-typedef struct StrListItem StrListItem;
-typedef struct StrList     StrList;
+typedef struct StrTable StrTable;
 
-struct StrListItem {
-    char*        str;
-    StrListItem* next;
-};
-struct StrList {
-    StrListItem* first;
-    StrListItem* last;
-    int          count;
+/* Packed table of strings. Items live back to back in a single block,
+ * separated by '\n' and null terminated, so the block itself is the
+ * string list expected by the u8g2 selection list */
+struct StrTable {
+    char*     buf; /*!< Items separated by '\n', null terminated */
+    uint16_t* offsets; /*!< Start of each item within buf */
+    uint16_t  count; /*!< Number of items */
+    uint16_t  len; /*!< Bytes used in buf, null terminator excluded */
+    uint16_t  buf_cap;
+    uint16_t  offsets_cap;
+    bool      fixed; /*!< Storage not owned by the table, it never grows */
 };
 
-esp_err_t strListAppend(StrList* list, char* str);
-void      strListClear(StrList* list);
-int       strListFindItem(StrList* list, char* str);
-bool      strListEqual(StrList* list1, StrList* list2);
+void        strTableInitFixed(StrTable* table, char* buf, uint16_t buf_size, uint16_t* offsets, uint16_t max_items);
+esp_err_t   strTableAppend(StrTable* table, const char* str, uint16_t len);
+const char* strTableGet(const StrTable* table, uint16_t index, uint16_t* len);
+const char* strTableJoined(const StrTable* table);
+void        strTableClear(StrTable* table);
+int         strTableFindItem(const StrTable* table, const char* str);
+bool        strTableEqual(const StrTable* table1, const StrTable* table2);
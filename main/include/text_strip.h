@@ -0,0 +1,40 @@
+/**
+ * @file text_strip.h
+ * @brief Off-screen 1-bpp strip holding a pre-rendered line of text. The
+ * text is rendered once, then any window of it can be copied to the frame
+ * buffer without decoding glyphs again. Meant for scrolling messages.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+
+#include "u8g2.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/* One extra byte: the blit reads one byte past the window */
+#define TEXT_STRIP_BUF_SIZE(max_width, tile_rows) ((max_width) / 8 * (tile_rows)*8 + 1)
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct {
+    u8g2_t              u8g2; /*!< Renders into the strip. Must be the first member */
+    u8x8_display_info_t info; /*!< Dimensions of the strip */
+    u8g2_uint_t         width; /*!< Width of the rendered text, 0 if none */
+    int8_t              ascent;
+    uint8_t             height; /*!< Pixel rows taken by the text */
+} text_strip_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void text_strip_init(text_strip_t* strip, uint8_t* buf, u8g2_uint_t max_width, uint8_t tile_rows);
+bool text_strip_render(text_strip_t* strip, const uint8_t* font, const char* str);
+void text_strip_blit(text_strip_t* strip, u8g2_t* dst, u8g2_uint_t from, int baseline, int top, int bottom);
+
+#ifdef __cplusplus
+}
+#endif
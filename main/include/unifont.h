@@ -0,0 +1,47 @@
+/**
+ * @file unifont.h
+ * @brief Large Unicode bitmap font (GNU Unifont, BMP only) read from the
+ * storage partition. Glyphs are loaded on demand into a small LRU cache in
+ * RAM, so once a text is cached it renders without touching the flash.
+ *
+ * The font file is generated with tools/unifont_bin.py, see README.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "u8g2.h"
+
+/* Exported macro ------------------------------------------------------------*/
+#define UNIFONT_PATH       "/spiffs/unifont.bin"
+#define UNIFONT_CACHE_SIZE 64 /* glyphs kept in RAM */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t flash_reads;
+} unifont_stats_t;
+
+/* Exported functions prototypes ---------------------------------------------*/
+esp_err_t   unifont_init(void);
+bool        unifont_needed(const char* str);
+int8_t      unifont_ascent(void);
+int8_t      unifont_descent(void);
+u8g2_uint_t unifont_width(const char* str);
+u8g2_uint_t unifont_draw(u8g2_t* u8g2, u8g2_uint_t x, u8g2_uint_t y, const char* str);
+void        unifont_stats(unifont_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @file input.c
+ * @brief Once a rotation is received, whatever else is queued is drained and
+ * summed up. The rate of the detents read within a gesture (detents with no
+ * pause longer than GESTURE_GAP_MS) sets a gain applied to the sum: slow
+ * turns move one step per detent, fast spins up to ACCEL_MAX_GAIN.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "esp_log.h"
+#include "freertos/task.h"
+
+#include "input.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define GESTURE_GAP_MS 300 /* a longer pause ends the gesture */
+#define ACCEL_MIN_RATE 8 /* detents per second, below it no acceleration */
+#define ACCEL_MAX_RATE 40 /* detents per second for the max gain */
+#define ACCEL_MAX_GAIN 8
+
+/* Locally scoped variables --------------------------------------------------*/
+static const char* TAG = "INPUT";
+
+/* Private function prototypes -----------------------------------------------*/
+static bool     receive(input_t* input, rotary_encoder_event_t* event, TickType_t ticks);
+static bool     receive_serving(input_t* input, rotary_encoder_event_t* event, TickType_t ticks);
+static uint16_t gain(uint16_t rate);
+
+/* Exported functions --------------------------------------------------------*/
+void input_init(input_t* input, QueueHandle_t queue, QueueSetHandle_t set)
+{
+    *input = (input_t) {
+        .queue = queue,
+        .set = set,
+        .last_detent = xTaskGetTickCount() - pdMS_TO_TICKS(GESTURE_GAP_MS) - 1,
+    };
+}
+
+/**
+ * @brief Wait up to ticks_timeout for the next input. A rotation carries all
+ * the detents queued, a button event found among them is returned on the
+ * next call. delta can be 0 if the detents cancel each other out.
+ *
+ * @retval false on timeout
+ */
+bool input_read(input_t* input, input_event_t* event, TickType_t ticks_timeout)
+{
+    rotary_encoder_event_t queue_event;
+
+    if (input->held) {
+        input->held = false;
+        queue_event = input->held_event;
+    } else if (!receive(input, &queue_event, ticks_timeout)) {
+        return false;
+    }
+
+    if (queue_event.event_type == BUTTON_EVENT) {
+        event->type = BUTTON_EVENT;
+        event->btn_event = queue_event.btn_event;
+        return true;
+    }
+
+    int32_t  net = 0;
+    uint16_t detents = 0;
+    do {
+        if (queue_event.event_type == BUTTON_EVENT) { /* keep it for the next call */
+            input->held = true;
+            input->held_event = queue_event;
+            break;
+        }
+        net += queue_event.re_state.direction == ROTARY_ENCODER_DIRECTION_CLOCKWISE ? 1 : -1;
+        detents++;
+    } while (receive(input, &queue_event, 0));
+
+    TickType_t now = xTaskGetTickCount();
+    uint32_t   gap_ms = pdTICKS_TO_MS(now - input->last_detent);
+    bool       new_gesture = gap_ms > GESTURE_GAP_MS;
+
+    if (new_gesture) {
+        input->rate = 0; /* the first detents are always precise */
+    } else {
+        uint32_t rate = detents * 1000 / (gap_ms ? gap_ms : 1);
+        input->rate = (input->rate * 3 + (rate > 1000 ? 1000 : rate)) / 4;
+    }
+    input->last_detent = now;
+
+    int32_t delta = net * gain(input->rate);
+    if (delta > INT16_MAX) {
+        delta = INT16_MAX;
+    } else if (delta < -INT16_MAX) {
+        delta = -INT16_MAX;
+    }
+
+    event->type = ROTARY_ENCODER_EVENT;
+    event->delta = delta;
+    event->detents = detents;
+    event->new_gesture = new_gesture;
+
+    input->detents += detents;
+    input->reads++;
+    if (detents > 1) {
+        ESP_LOGD(TAG, "%u detents in one read, %u/s, %d steps (%u detents in %u reads)",
+            detents, input->rate, event->delta, input->detents, input->reads);
+    }
+    return true;
+}
+
+/**
+ * @brief The caller was busy (e.g. waiting for a request) and the detents
+ * queued meanwhile belong to the gesture that made it busy.
+ *
+ */
+void input_continue_gesture(input_t* input)
+{
+    input->last_detent = xTaskGetTickCount();
+}
+
+/**
+ * @brief While input_read() waits, cb is called whenever the other members
+ * of the set may have items queued, to read them. Otherwise a long wait for
+ * input (e.g. in a menu) lets them fill up.
+ *
+ */
+void input_set_other_cb(input_t* input, void (*cb)(void* ctx), void* ctx)
+{
+    assert(input->set && "No other members without a set");
+    input->other_cb = cb;
+    input->other_ctx = ctx;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief The queue is read without selecting it from its set, so one entry
+ * of the set is taken for each item. Otherwise the set would fill up with
+ * entries of items already read.
+ *
+ */
+static bool receive(input_t* input, rotary_encoder_event_t* event, TickType_t ticks)
+{
+    if (input->other_cb && ticks != 0)
+        return receive_serving(input, event, ticks);
+    if (pdTRUE != xQueueReceive(input->queue, event, ticks))
+        return false;
+    if (input->set)
+        xQueueSelectFromSet(input->set, 0);
+    return true;
+}
+
+/**
+ * @brief Wait on the whole set instead of the queue alone. The entry taken
+ * by a wake may belong to any member, so every source is checked before
+ * blocking again.
+ *
+ */
+static bool receive_serving(input_t* input, rotary_encoder_event_t* event, TickType_t ticks)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (1) {
+        if (receive(input, event, 0))
+            return true;
+        input->other_cb(input->other_ctx);
+
+        TickType_t left = portMAX_DELAY;
+        if (ticks != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks)
+                return false;
+            left = ticks - elapsed;
+        }
+        if (xQueueSelectFromSet(input->set, left) == NULL)
+            return false;
+    }
+}
+
+static uint16_t gain(uint16_t rate)
+{
+    if (rate <= ACCEL_MIN_RATE)
+        return 1;
+    if (rate >= ACCEL_MAX_RATE)
+        return ACCEL_MAX_GAIN;
+    return 1 + (rate - ACCEL_MIN_RATE) * (ACCEL_MAX_GAIN - 1) / (ACCEL_MAX_RATE - ACCEL_MIN_RATE);
+}
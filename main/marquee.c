@@ -0,0 +1,165 @@
+/* Includes ------------------------------------------------------------------*/
+#include "freertos/task.h"
+
+#include "marquee.h"
+#include "render_sched.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define SCROLL_MS_PER_PX        50
+#define FLANK_PAUSE_MS          1000
+#define SCROLL_MS(span)         ((span)*SCROLL_MS_PER_PX)
+#define MARQUEE_PERIOD_MS(span) (2 * FLANK_PAUSE_MS + SCROLL_MS(span))
+#define MS_TO_TICKS_CEIL(ms)    pdMS_TO_TICKS((ms) + portTICK_PERIOD_MS - 1)
+
+/* Private function prototypes -----------------------------------------------*/
+static u8g2_uint_t scroll_offset(marquee_region_t* region, u8g2_uint_t view_width,
+    TickType_t now, TickType_t* next);
+static uint32_t    hash_text(const char* text);
+
+/* Exported functions --------------------------------------------------------*/
+void marquee_init(marquee_t* marquee, u8g2_t* u8g2, marquee_region_t* regions, uint8_t count)
+{
+    marquee->u8g2 = u8g2;
+    marquee->regions = regions;
+    marquee->count = count;
+}
+
+/**
+ * @brief Set up a region drawing with font at baseline. buf must hold
+ * MARQUEE_BUF_SIZE(max_width, tile_rows) bytes. The region may draw on any
+ * row, see marquee_region_clip().
+ *
+ */
+void marquee_region_init(marquee_region_t* region, uint8_t* buf, u8g2_uint_t max_width,
+    uint8_t tile_rows, const uint8_t* font, u8g2_uint_t baseline)
+{
+    text_strip_init(&region->strip, buf, max_width, tile_rows);
+    region->font = font;
+    region->baseline = baseline;
+    region->top = 0;
+    region->bottom = UINT16_MAX;
+    region->text_hash = 0;
+    region->start_tick = xTaskGetTickCount();
+}
+
+/**
+ * @brief Keep the region within rows top to bottom (excluded). Text drawn
+ * with the Unicode font is taller than most fonts, it's cut instead of
+ * drawing over the next region.
+ *
+ */
+void marquee_region_clip(marquee_region_t* region, u8g2_uint_t top, u8g2_uint_t bottom)
+{
+    region->top = top;
+    region->bottom = bottom;
+}
+
+/**
+ * @brief Render the text of a region. Setting the text it already shows is
+ * a no-op, so its scroll phase isn't restarted.
+ *
+ */
+void marquee_set_text(marquee_t* marquee, uint8_t region, const char* text)
+{
+    marquee_region_t* r = &marquee->regions[region];
+    uint32_t          hash = hash_text(text);
+
+    if (hash == r->text_hash)
+        return;
+    r->text_hash = hash;
+    text_strip_render(&r->strip, r->font, text);
+    r->start_tick = xTaskGetTickCount();
+}
+
+/**
+ * @brief Tick when the text of a region reaches the right flank for the
+ * cycles-th time. For a text that fits, when it was set.
+ *
+ */
+TickType_t marquee_cycles_end(marquee_t* marquee, uint8_t region, uint8_t cycles)
+{
+    marquee_region_t* r = &marquee->regions[region];
+    u8g2_uint_t       view_width = u8g2_GetDisplayWidth(marquee->u8g2);
+
+    if (r->strip.width <= view_width || cycles == 0)
+        return r->start_tick;
+    uint32_t span = r->strip.width - view_width;
+    return r->start_tick
+        + pdMS_TO_TICKS((cycles - 1) * MARQUEE_PERIOD_MS(span) + FLANK_PAUSE_MS + SCROLL_MS(span));
+}
+
+/**
+ * @brief Draw every region at its scroll offset for tick now.
+ *
+ * @return The tick when any of the offsets changes next, or
+ * RENDER_NO_DEADLINE if all regions fit on display
+ */
+TickType_t marquee_draw(marquee_t* marquee, TickType_t now)
+{
+    TickType_t  deadline = RENDER_NO_DEADLINE;
+    u8g2_uint_t view_width = u8g2_GetDisplayWidth(marquee->u8g2);
+
+    for (uint8_t i = 0; i < marquee->count; i++) {
+        marquee_region_t* r = &marquee->regions[i];
+        TickType_t        next;
+
+        if (r->strip.width == 0)
+            continue;
+        u8g2_uint_t from = scroll_offset(r, view_width, now, &next);
+        text_strip_blit(&r->strip, marquee->u8g2, from, r->baseline, r->top, r->bottom);
+
+        if (next != RENDER_NO_DEADLINE
+            && (deadline == RENDER_NO_DEADLINE || (int32_t)(next - deadline) < 0)) {
+            deadline = next;
+        }
+    }
+    return deadline;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief First strip column shown at tick now. A text wider than the view
+ * rests FLANK_PAUSE_MS on each flank, and scrolls one pixel every
+ * SCROLL_MS_PER_PX in between.
+ *
+ * @param next Set to the tick when the offset changes next, or
+ * RENDER_NO_DEADLINE if the text fits
+ */
+static u8g2_uint_t scroll_offset(marquee_region_t* region, u8g2_uint_t view_width,
+    TickType_t now, TickType_t* next)
+{
+    if (region->strip.width <= view_width) {
+        *next = RENDER_NO_DEADLINE;
+        return 0;
+    }
+    uint32_t span = region->strip.width - view_width;
+    uint32_t t = pdTICKS_TO_MS(now - region->start_tick) % MARQUEE_PERIOD_MS(span);
+    uint32_t px, change_at; /* ms into the period when the offset changes */
+
+    if (t < FLANK_PAUSE_MS) { /* left flank */
+        px = 0;
+        change_at = FLANK_PAUSE_MS + SCROLL_MS_PER_PX;
+    } else if (t < FLANK_PAUSE_MS + SCROLL_MS(span)) {
+        px = (t - FLANK_PAUSE_MS) / SCROLL_MS_PER_PX;
+        change_at = FLANK_PAUSE_MS + SCROLL_MS(px + 1);
+    } else { /* right flank */
+        px = span;
+        change_at = MARQUEE_PERIOD_MS(span);
+    }
+    *next = now + MS_TO_TICKS_CEIL(change_at - t);
+    return px;
+}
+
+/**
+ * @brief FNV-1a, never 0 so a new region always renders its first text.
+ *
+ */
+static uint32_t hash_text(const char* text)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*text)
+        hash = (hash ^ (uint8_t)*text++) * 16777619u;
+    return hash ? hash : 1;
+}
@@ -0,0 +1,219 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "display_flush.h"
+#include "overlay.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define ACQUIRE_LOCK(mux) xSemaphoreTake(mux, portMAX_DELAY)
+#define RELEASE_LOCK(mux) xSemaphoreGive(mux)
+
+#define OVERLAY_FONT   u8g2_font_6x12_te
+#define LINE_HEIGHT    12
+#define MAX_LINES      3
+#define BOX_MARGIN     4
+#define BOX_PADDING    3
+#define BAR_WIDTH      3
+#define BAR_PADDING    1
+#define VOLUME_BOX_TOP 30
+
+/* Private types -------------------------------------------------------------*/
+typedef enum {
+    OVERLAY_NONE,
+    OVERLAY_TEXT,
+    OVERLAY_VOLUME,
+} overlay_kind_t;
+
+/* Locally scoped variables --------------------------------------------------*/
+static SemaphoreHandle_t s_lock = NULL; /* guards the overlay state */
+static TimerHandle_t     s_timer = NULL;
+static overlay_kind_t    s_kind = OVERLAY_NONE;
+static char              s_text[OVERLAY_TEXT_MAX];
+static uint8_t           s_percent;
+static TickType_t        s_until; /* tick the overlay expires */
+
+/* Private function prototypes -----------------------------------------------*/
+static void    show(overlay_kind_t kind, uint32_t duration_ms);
+static void    expire_cb(TimerHandle_t timer);
+static void    draw_text(u8g2_t* u8g2);
+static void    draw_volume(u8g2_t* u8g2);
+static uint8_t wrap_lines(u8g2_t* u8g2, const char* text, u8g2_uint_t max_width,
+       const char** starts, uint8_t* lens);
+
+/* Exported functions --------------------------------------------------------*/
+void overlay_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    assert(s_lock && "Error on xSemaphoreCreateMutex()");
+    s_timer = xTimerCreate("overlay", 1, pdFALSE, NULL, expire_cb);
+    assert(s_timer && "Error on xTimerCreate()");
+}
+
+/**
+ * @brief Show text on top of the page for duration_ms. Long text is wrapped
+ * in up to MAX_LINES lines. Replaces any overlay being shown.
+ *
+ */
+void overlay_show_text(const char* text, uint32_t duration_ms)
+{
+    ACQUIRE_LOCK(s_lock);
+    snprintf(s_text, sizeof(s_text), "%s", text);
+    RELEASE_LOCK(s_lock);
+    show(OVERLAY_TEXT, duration_ms);
+}
+
+void overlay_show_volume(uint8_t percent, uint32_t duration_ms)
+{
+    ACQUIRE_LOCK(s_lock);
+    s_percent = percent > 100 ? 100 : percent;
+    RELEASE_LOCK(s_lock);
+    show(OVERLAY_VOLUME, duration_ms);
+}
+
+void overlay_hide(void)
+{
+    xTimerStop(s_timer, 0);
+    ACQUIRE_LOCK(s_lock);
+    s_kind = OVERLAY_NONE;
+    RELEASE_LOCK(s_lock);
+    display_flush_refresh();
+}
+
+/**
+ * @brief Draw the overlay, if any, on u8g2. Called by display_flush on the
+ * copy of the frame that goes to the display, the page's own buffer is
+ * never touched. An overlay whose time is up is dropped here.
+ *
+ */
+void overlay_draw(u8g2_t* u8g2)
+{
+    if (s_lock == NULL)
+        return;
+
+    ACQUIRE_LOCK(s_lock);
+    if (s_kind != OVERLAY_NONE && (int32_t)(xTaskGetTickCount() - s_until) >= 0)
+        s_kind = OVERLAY_NONE;
+    if (s_kind == OVERLAY_TEXT) {
+        draw_text(u8g2);
+    } else if (s_kind == OVERLAY_VOLUME) {
+        draw_volume(u8g2);
+    }
+    RELEASE_LOCK(s_lock);
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void show(overlay_kind_t kind, uint32_t duration_ms)
+{
+    ACQUIRE_LOCK(s_lock);
+    s_kind = kind;
+    s_until = xTaskGetTickCount() + pdMS_TO_TICKS(duration_ms);
+    RELEASE_LOCK(s_lock);
+    /* (re)starts the one-shot timer */
+    xTimerChangePeriod(s_timer, pdMS_TO_TICKS(duration_ms), 0);
+    display_flush_refresh();
+}
+
+/**
+ * @brief Runs on the timer service task, which must not block: the flush
+ * task composes the frame, and overlay_draw() drops the expired overlay.
+ *
+ */
+static void expire_cb(TimerHandle_t timer)
+{
+    display_flush_request_refresh();
+}
+
+static void draw_text(u8g2_t* u8g2)
+{
+    const char* starts[MAX_LINES];
+    uint8_t     lens[MAX_LINES];
+    char        line[OVERLAY_TEXT_MAX];
+
+    u8g2_SetFont(u8g2, OVERLAY_FONT);
+    u8g2_SetFontPosBaseline(u8g2);
+    uint8_t box_w = u8g2_GetDisplayWidth(u8g2) - 2 * BOX_MARGIN;
+    uint8_t lines = wrap_lines(u8g2, s_text, box_w - 2 * BOX_PADDING, starts, lens);
+    uint8_t box_h = lines * LINE_HEIGHT + 2 * BOX_PADDING;
+    uint8_t box_y = (u8g2_GetDisplayHeight(u8g2) - box_h) / 2;
+
+    u8g2_SetDrawColor(u8g2, 0); /* clear what's under the box */
+    u8g2_DrawBox(u8g2, BOX_MARGIN, box_y, box_w, box_h);
+    u8g2_SetDrawColor(u8g2, 1);
+    u8g2_DrawFrame(u8g2, BOX_MARGIN, box_y, box_w, box_h);
+
+    for (uint8_t i = 0; i < lines; i++) {
+        memcpy(line, starts[i], lens[i]);
+        line[lens[i]] = '\0';
+        u8g2_DrawUTF8(u8g2, BOX_MARGIN + BOX_PADDING,
+            box_y + BOX_PADDING + (i + 1) * LINE_HEIGHT - 2, line);
+    }
+}
+
+static void draw_volume(u8g2_t* u8g2)
+{
+    uint8_t box_w = u8g2_GetDisplayWidth(u8g2) - 2 * BOX_MARGIN;
+    uint8_t box_h = u8g2_GetDisplayHeight(u8g2) - VOLUME_BOX_TOP - BOX_MARGIN;
+    uint8_t inner_w = box_w - 2 * BOX_PADDING;
+    uint8_t max_height = box_h - 2 * BOX_PADDING;
+    uint8_t width_percent = (s_percent * inner_w) / 100;
+    uint8_t bottom = VOLUME_BOX_TOP + box_h - BOX_PADDING;
+
+    u8g2_SetDrawColor(u8g2, 0);
+    u8g2_DrawBox(u8g2, BOX_MARGIN, VOLUME_BOX_TOP, box_w, box_h);
+    u8g2_SetDrawColor(u8g2, 1);
+    u8g2_DrawFrame(u8g2, BOX_MARGIN, VOLUME_BOX_TOP, box_w, box_h);
+
+    for (uint8_t x = 0; x < width_percent; x += (BAR_WIDTH + BAR_PADDING)) {
+        uint8_t bar_height = 1 + (x * (max_height - 1)) / inner_w;
+        u8g2_DrawBox(u8g2, BOX_MARGIN + BOX_PADDING + x, bottom - bar_height, BAR_WIDTH, bar_height);
+    }
+}
+
+/**
+ * @brief Split text in lines no wider than max_width, breaking at spaces.
+ * A word wider than a line takes a line of its own. Text past MAX_LINES is
+ * left out.
+ *
+ * @return The number of lines
+ */
+static uint8_t wrap_lines(u8g2_t* u8g2, const char* text, u8g2_uint_t max_width,
+    const char** starts, uint8_t* lens)
+{
+    char    buf[OVERLAY_TEXT_MAX];
+    uint8_t lines = 0;
+
+    while (*text && lines < MAX_LINES) {
+        while (*text == ' ')
+            text++;
+        size_t fit = 0, end = 0; /* fit: last break that fits */
+        while (text[end]) {
+            size_t next = end;
+            while (text[next] == ' ')
+                next++;
+            while (text[next] && text[next] != ' ')
+                next++;
+            memcpy(buf, text, next);
+            buf[next] = '\0';
+            if (u8g2_GetUTF8Width(u8g2, buf) > max_width)
+                break;
+            fit = end = next;
+        }
+        if (fit == 0) { /* a single word wider than the line */
+            while (text[fit] && text[fit] != ' ')
+                fit++;
+        }
+        if (fit == 0)
+            break;
+        starts[lines] = text;
+        lens[lines] = fit;
+        lines++;
+        text += fit;
+    }
+    return lines;
+}
@@ -7,17 +7,15 @@
 #include "parseobjects.h"
 
 /* Private macro -------------------------------------------------------------*/
-#define TRACK_CALLBACKS_SIZE  6
+#define TRACK_CALLBACKS_SIZE  7
 #define TOKENS_CALLBACKS_SIZE 2
-#define MAX_TOKENS            500
-#define PLAYLISTS_TOKENS      200
-#define DEVICES_TOKENS        200
 
 /* Private types -------------------------------------------------------------*/
 typedef void (*PathCb)(const char*, jsmntok_t*, void*);
 
 /* Private function prototypes -----------------------------------------------*/
 static void       onDevicePlaying(const char* js, jsmntok_t* root, void* obj);
+static void       onTrackUri(const char* js, jsmntok_t* root, void* obj);
 static void       onTrackName(const char* js, jsmntok_t* root, void* obj);
 static void       onArtistsName(const char* js, jsmntok_t* root, void* obj);
 static void       onAlbumName(const char* js, jsmntok_t* root, void* obj);
@@ -26,15 +24,17 @@ static void       onTrackTime(const char* js, jsmntok_t* root, void* obj);
 static void       onAccessToken(const char* js, jsmntok_t* root, void* obj);
 static void       onExpiresIn(const char* js, jsmntok_t* root, void* obj);
 static inline int natoi(const char* str, short len);
-static void       parsejson(const char* js, PathCb* callbacks, size_t callbacksSize, void* obj);
-esp_err_t static str_append(jsmntok_t* obj, const char* buff, char** str);
-static inline esp_err_t uri_append(jsmntok_t* obj, const char* buf);
+static char*      track_strdup(TrackInfo* track, const char* js, jsmntok_t* obj, size_t max);
+static size_t     utf8_clamp(const char* str, size_t len, size_t max);
+static esp_err_t  tok_append(StrTable* table, const char* js, jsmntok_t* obj);
+static bool       str_differ(const char* a, const char* b);
+static jsmntok_t* tokenize(request_arena_t* req, const char* js, size_t len);
+static void       parsejson(request_arena_t* req, PathCb* callbacks, size_t callbacksSize, void* obj);
 
 /* Locally scoped variables --------------------------------------------------*/
 static const char* TAG = "PARSE_OBJECT";
 PathCb             trackCallbacks[TRACK_CALLBACKS_SIZE];
 PathCb             tokensCallbacks[TOKENS_CALLBACKS_SIZE];
-static jsmntok_t   tokens[MAX_TOKENS];
 
 /* Globally scoped variables definitions -------------------------------------*/
 u8g2_items_list_t PLAYLISTS = { 0 };
@@ -49,33 +49,86 @@ void init_functions_cb()
     trackCallbacks[3] = onTrackIsPlaying;
     trackCallbacks[4] = onTrackTime;
     trackCallbacks[5] = onDevicePlaying;
+    trackCallbacks[6] = onTrackUri;
 
     tokensCallbacks[0] = onAccessToken;
     tokensCallbacks[1] = onExpiresIn;
 }
 
-void parseTrackInfo(const char* js, TrackInfo* track)
+void track_info_init(TrackInfo* track)
 {
-    parsejson(js, trackCallbacks, TRACK_CALLBACKS_SIZE, track);
+    arena_init(&track->arena, track->arena_buf, sizeof(track->arena_buf));
+    track_info_reset(track);
 }
 
-void parseTokens(const char* js, Tokens* tokens)
+/**
+ * @brief Drop every string of the snapshot at once. No heap memory is
+ * involved, the arena just rewinds.
+ *
+ */
+void track_info_reset(TrackInfo* track)
 {
-    parsejson(js, tokensCallbacks, TOKENS_CALLBACKS_SIZE, tokens);
+    arena_reset(&track->arena);
+
+    char*     artists_buf = arena_alloc(&track->arena, MAX_ARTISTS * ARTIST_NAME_MAX);
+    uint16_t* artists_offsets = arena_alloc(&track->arena, MAX_ARTISTS * sizeof(uint16_t));
+    strTableInitFixed(&track->artists, artists_buf, MAX_ARTISTS * ARTIST_NAME_MAX,
+        artists_offsets, MAX_ARTISTS);
+
+    track->uri = "";
+    track->name = "";
+    track->album = "";
+    track->device.id = NULL;
+    track->device.name = NULL;
+    track->device.type = NULL;
+    strcpy(track->device.volume_percent, "-1");
 }
 
-esp_err_t parse_available_devices(const char* js)
+/**
+ * @brief Compare two snapshots field by field.
+ *
+ * @return track_change_t bits of the fields that differ. Progress isn't
+ * compared, it moves on its own while playing
+ */
+uint16_t track_info_diff(const TrackInfo* old, const TrackInfo* new)
 {
-    jsmn_parser jsmn;
-    jsmn_init(&jsmn);
+    uint16_t changes = 0;
+
+    if (str_differ(old->uri, new->uri))
+        changes |= TRACK_CHANGED_ITEM;
+    if (str_differ(old->name, new->name))
+        changes |= TRACK_CHANGED_TITLE;
+    if (!strTableEqual(&old->artists, &new->artists))
+        changes |= TRACK_CHANGED_ARTISTS;
+    if (str_differ(old->album, new->album))
+        changes |= TRACK_CHANGED_ALBUM;
+    if (old->isPlaying != new->isPlaying)
+        changes |= TRACK_CHANGED_PLAY_STATE;
+    if (str_differ(old->device.id, new->device.id) || str_differ(old->device.name, new->device.name))
+        changes |= TRACK_CHANGED_DEVICE;
+    if (strcmp(old->device.volume_percent, new->device.volume_percent))
+        changes |= TRACK_CHANGED_VOLUME;
+    return changes;
+}
+
+void parseTrackInfo(request_arena_t* req, TrackInfo* track)
+{
+    track_info_reset(track);
 
-    esp_err_t err = ESP_FAIL;
+    parsejson(req, trackCallbacks, TRACK_CALLBACKS_SIZE, track);
+}
 
-    jsmnerr_t n = jsmn_parse(&jsmn, js, strlen(js), tokens, DEVICES_TOKENS);
-    if (n < 0) {
-        ESP_LOGE(TAG, "%s", error_str(n));
-        abort();
-    }
+void parseTokens(request_arena_t* req, Tokens* tokens)
+{
+    parsejson(req, tokensCallbacks, TOKENS_CALLBACKS_SIZE, tokens);
+}
+
+esp_err_t parse_available_devices(request_arena_t* req)
+{
+    const char* js = req->buffer;
+    esp_err_t   err = ESP_FAIL;
+
+    jsmntok_t* tokens = tokenize(req, js, strlen(js));
 
     jsmntok_t* devices = object_get_member(js, tokens, "devices");
     assert(devices && "key \"devices\" missing");
@@ -92,31 +145,22 @@ esp_err_t parse_available_devices(const char* js)
         jsmntok_t* value = object_get_member(js, device, "name");
         assert(value && "key \"name\" missing");
 
-        err = str_append(value, js, &DEVICES.items_string);
-        assert((ESP_OK == err) && "str_append() failed. Error allocating memory");
+        err = tok_append(&DEVICES.names, js, value);
+        assert((ESP_OK == err) && "tok_append() failed. Error allocating memory");
 
         value = object_get_member(js, device, "id");
         assert(value && "key \"id\" missing");
 
-        char* id = jsmn_obj_dup(js, value);
-        assert(id && "jsmn_obj_dup() failed. Error allocating memory");
-
-        err = strListAppend(&DEVICES.values, id);
-        assert((ESP_OK == err) && "strListAppend() failed. Error allocating memory");
+        err = tok_append(&DEVICES.values, js, value);
+        assert((ESP_OK == err) && "tok_append() failed. Error allocating memory");
     }
     return ESP_OK;
 }
 
-void parse_playlist(const char* js, int output_len)
+void parse_playlist(request_arena_t* req, int output_len)
 {
-    jsmn_parser jsmn;
-    jsmn_init(&jsmn);
-
-    jsmnerr_t n = jsmn_parse(&jsmn, js, output_len, tokens, PLAYLISTS_TOKENS);
-    if (n < 0) {
-        ESP_LOGE(TAG, "%s", error_str(n));
-        abort();
-    }
+    const char* js = req->buffer;
+    jsmntok_t*  tokens = tokenize(req, js, output_len);
 
     jsmntok_t* name = object_get_member(js, tokens, "name");
     assert(name && "key \"name\" missing");
@@ -124,11 +168,11 @@ void parse_playlist(const char* js, int output_len)
     jsmntok_t* uri = object_get_member(js, tokens, "uri");
     assert(uri && "key \"uri\" missing");
 
-    esp_err_t err = str_append(name, js, &PLAYLISTS.items_string);
-    assert((ESP_OK == err) && "str_append() failed. Error allocating memory");
+    esp_err_t err = tok_append(&PLAYLISTS.names, js, name);
+    assert((ESP_OK == err) && "tok_append() failed. Error allocating memory");
 
-    err = uri_append(uri, js);
-    assert((ESP_OK == err) && "uri_append() failed. Error allocating memory");
+    err = tok_append(&PLAYLISTS.values, js, uri);
+    assert((ESP_OK == err) && "tok_append() failed. Error allocating memory");
 }
 
 /* Private functions ---------------------------------------------------------*/
@@ -142,14 +186,17 @@ static void onDevicePlaying(const char* js, jsmntok_t* root, void* obj)
     jsmntok_t* value = object_get_member(js, device, "id");
     assert(value && "key \"id\" missing");
 
-    track->device.id = jsmn_obj_dup(js, value);
-    assert(track->device.id && "Error allocating memory");
+    track->device.id = track_strdup(track, js, value, DEVICE_ID_MAX);
 
     value = object_get_member(js, device, "name");
     assert(value && "key \"name\" missing");
 
-    track->device.name = jsmn_obj_dup(js, value);
-    assert(track->device.name && "Error allocating memory");
+    track->device.name = track_strdup(track, js, value, DEVICE_NAME_MAX);
+
+    value = object_get_member(js, device, "type");
+    assert(value && "key \"type\" missing");
+
+    track->device.type = track_strdup(track, js, value, DEVICE_TYPE_MAX);
 
     value = object_get_member(js, device, "volume_percent");
     assert(value && "key \"volume_percent\" missing");
@@ -159,6 +206,21 @@ static void onDevicePlaying(const char* js, jsmntok_t* root, void* obj)
     ESP_LOGD(TAG, "Device id: %s, name: %s", track->device.id, track->device.name);
 }
 
+static void onTrackUri(const char* js, jsmntok_t* root, void* obj)
+{
+    TrackInfo* track = (TrackInfo*)obj;
+
+    jsmntok_t* value = object_get_member(js, root, "item");
+    assert(value && "key \"item\" missing");
+
+    value = object_get_member(js, value, "uri");
+    assert(value && "key \"uri\" missing");
+
+    track->uri = track_strdup(track, js, value, TRACK_URI_MAX);
+
+    ESP_LOGD(TAG, "Uri: %s", track->uri);
+}
+
 static void onTrackName(const char* js, jsmntok_t* root, void* obj)
 {
     TrackInfo* track = (TrackInfo*)obj;
@@ -169,8 +231,7 @@ static void onTrackName(const char* js, jsmntok_t* root, void* obj)
     value = object_get_member(js, value, "name");
     assert(value && "key \"name\" missing");
 
-    track->name = jsmn_obj_dup(js, value);
-    assert(track->name && "Error allocating memory");
+    track->name = track_strdup(track, js, value, TRACK_NAME_MAX);
 
     ESP_LOGD(TAG, "Track: %s", track->name);
 }
@@ -186,18 +247,18 @@ static void onArtistsName(const char* js, jsmntok_t* root, void* obj)
     assert(value && "key \"artists\" missing");
 
     jsmntok_t* artists = value;
-    for (uint16_t i = 0; i < (artists->size); i++) {
+    for (uint16_t i = 0; i < (artists->size) && i < MAX_ARTISTS; i++) {
         value = array_get_at(artists, i);
         assert(value && "array_get_at() failed. Maybe not an array");
 
         value = object_get_member(js, value, "name");
         assert(value && "key \"name\" missing");
 
-        char* artist = jsmn_obj_dup(js, value);
-        assert(artist && "Error allocating memory");
+        const char* artist = js + value->start;
+        size_t      len = utf8_clamp(artist, value->end - value->start, ARTIST_NAME_MAX);
 
-        esp_err_t err = strListAppend(&track->artists, artist);
-        assert((err == ESP_OK) && "Error allocating memory");
+        esp_err_t err = strTableAppend(&track->artists, artist, len);
+        assert((err == ESP_OK) && "Track arena exhausted");
     }
 }
 
@@ -214,8 +275,7 @@ static void onAlbumName(const char* js, jsmntok_t* root, void* obj)
     value = object_get_member(js, value, "name");
     assert(value && "key \"name\" missing");
 
-    track->album = jsmn_obj_dup(js, value);
-    assert(track->album && "Error allocating memory");
+    track->album = track_strdup(track, js, value, ALBUM_NAME_MAX);
 
     ESP_LOGD(TAG, "Album: %s", track->album);
 }
@@ -281,63 +341,83 @@ static inline int natoi(const char* str, short len)
     return ret;
 }
 
-static void parsejson(const char* js, PathCb* callbacks, size_t callbacksSize, void* obj)
+/**
+ * @brief Copy the string of a token into the track arena. Strings longer
+ * than max (null terminator included) are cut, without splitting a UTF-8
+ * multibyte sequence.
+ *
+ */
+static char* track_strdup(TrackInfo* track, const char* js, jsmntok_t* obj, size_t max)
 {
-    jsmn_parser jsmn;
-    jsmn_init(&jsmn);
-
-    jsmnerr_t n = jsmn_parse(&jsmn, js, strlen(js), tokens, MAX_TOKENS);
-    if (n < 0) {
-        ESP_LOGE(TAG, "%s", error_str(n));
-        ESP_LOGE(TAG, "%s", js);
-        abort();
-    }
+    const char* str = js + obj->start;
+    size_t      len = utf8_clamp(str, obj->end - obj->start, max);
 
-    for (size_t i = 0; i < callbacksSize; i++) {
-        PathCb fn = callbacks[i];
-        fn(js, tokens, obj);
-    }
+    char* dup = arena_strndup(&track->arena, str, len);
+    assert(dup && "Track arena exhausted");
+    return dup;
 }
 
 /**
- * @brief u8g2 selection list menu uses a string with '\\n' as
- * item separator. For example: 'item1\\nitem2\\ngo to Menu\\nEtc...'.
- * This function build that string with each playlist name.
+ * @brief Length of str cut to fit in max bytes (null terminator included),
+ * without splitting a UTF-8 multibyte sequence.
  *
  */
-esp_err_t static str_append(jsmntok_t* obj, const char* buf, char** str)
+static size_t utf8_clamp(const char* str, size_t len, size_t max)
 {
-    if (*str == NULL) {
-        *str = jsmn_obj_dup(buf, obj);
-        return (*str == NULL) ? ESP_ERR_NO_MEM : ESP_OK;
+    if (len > max - 1) {
+        len = max - 1;
+        /* back off while str[len] is a continuation byte (10xxxxxx) */
+        while (len > 0 && (str[len] & 0xC0) == 0x80)
+            len--;
     }
+    return len;
+}
 
-    uint16_t obj_len = obj->end - obj->start;
-    uint16_t str_len = strlen(*str);
-
-    char* r = realloc(*str, str_len + obj_len + 2);
-    if (r == NULL)
-        return ESP_ERR_NO_MEM;
+static inline esp_err_t tok_append(StrTable* table, const char* js, jsmntok_t* obj)
+{
+    return strTableAppend(table, js + obj->start, obj->end - obj->start);
+}
 
-    *str = r;
+/**
+ * @brief Like strcmp() but NULL is a valid value, different from "".
+ *
+ */
+static bool str_differ(const char* a, const char* b)
+{
+    if (a == NULL || b == NULL)
+        return a != b;
+    return strcmp(a, b) != 0;
+}
 
-    (*str)[str_len++] = '\n';
+/**
+ * @brief Run jsmn over js using the tokens of the request in flight, and
+ * keep track of the token high water mark.
+ *
+ */
+static jsmntok_t* tokenize(request_arena_t* req, const char* js, size_t len)
+{
+    jsmn_parser jsmn;
+    jsmn_init(&jsmn);
 
-    for (uint16_t i = 0; i < obj_len; i++) {
-        (*str)[i + str_len] = *(buf + obj->start + i);
+    jsmnerr_t n = jsmn_parse(&jsmn, js, len, req->tokens, req->max_tokens);
+    if (n < 0) {
+        ESP_LOGE(TAG, "%s (%s)", error_str(n), req->budget->name);
+        ESP_LOGE(TAG, "%s", js);
+        abort();
     }
-    (*str)[str_len + obj_len] = '\0';
+    if (n > req->tokens_used)
+        req->tokens_used = n;
 
-    ESP_LOGI(TAG, "str len: %d", strlen(*str));
-
-    return ESP_OK;
+    return req->tokens;
 }
 
-static inline esp_err_t uri_append(jsmntok_t* obj, const char* buf)
+static void parsejson(request_arena_t* req, PathCb* callbacks, size_t callbacksSize, void* obj)
 {
-    char* uri = jsmn_obj_dup(buf, obj);
-    if (uri == NULL)
-        return ESP_ERR_NO_MEM;
+    const char* js = req->buffer;
+    jsmntok_t*  tokens = tokenize(req, js, strlen(js));
 
-    return strListAppend(&PLAYLISTS.values, uri);
+    for (size_t i = 0; i < callbacksSize; i++) {
+        PathCb fn = callbacks[i];
+        fn(js, tokens, obj);
+    }
 }
@@ -0,0 +1,138 @@
+/**
+ * @file rate_limit.c
+ * @brief The bucket is kept in milliseconds of refill: a token is
+ * RATE_REFILL_MS, and the level grows with the time elapsed up to
+ * RATE_BURST tokens. A class can take a token only while more than its
+ * reserve is left, commands have none.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "freertos/task.h"
+
+#include "rate_limit.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define RATE_BURST     8 /* tokens, requests that can go back to back */
+#define RATE_REFILL_MS 500 /* one token, 2 requests/s sustained */
+#define LEVEL_MAX      (RATE_BURST * RATE_REFILL_MS)
+#define BACKOFF_MAX_MS 30000 /* longest hold, whatever the server asks */
+
+/* Locally scoped variables --------------------------------------------------*/
+static const int32_t      RESERVE[RATE_CLASSES] = {
+    [RATE_COMMAND] = 0,
+    [RATE_POLL] = 2,
+    [RATE_LIST] = 4,
+};
+static portMUX_TYPE       s_mux = portMUX_INITIALIZER_UNLOCKED;
+static int32_t            s_level = LEVEL_MAX; /* ms of refill, negative during a backoff */
+static TickType_t         s_last_refill;
+static bool               s_started = false;
+static rate_limit_stats_t s_stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static void refill(void);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Take a token for a request of class cls.
+ *
+ * @retval false if none is left for the class, wait gets the ticks until
+ * there is one. Then wait (abortable if needed), call rate_limit_waited()
+ * and try again
+ */
+bool rate_limit_take(rate_class_t cls, TickType_t* wait)
+{
+    int32_t needed = (RESERVE[cls] + 1) * RATE_REFILL_MS;
+    bool    taken;
+
+    portENTER_CRITICAL(&s_mux);
+    refill();
+    taken = s_level >= needed;
+    if (taken) {
+        s_level -= RATE_REFILL_MS;
+        s_stats.granted[cls]++;
+    } else {
+        *wait = pdMS_TO_TICKS(needed - s_level + portTICK_PERIOD_MS - 1);
+    }
+    portEXIT_CRITICAL(&s_mux);
+    return taken;
+}
+
+/**
+ * @brief Account a request that waited ticks for its token.
+ *
+ */
+void rate_limit_waited(rate_class_t cls, TickType_t ticks)
+{
+    portENTER_CRITICAL(&s_mux);
+    s_stats.throttled[cls]++;
+    s_stats.waited_ms[cls] += pdTICKS_TO_MS(ticks);
+    portEXIT_CRITICAL(&s_mux);
+}
+
+/**
+ * @brief The server answered 429: empty the bucket and hold the refill for
+ * ms (its Retry-After), BACKOFF_MAX_MS at most in all.
+ *
+ */
+void rate_limit_backoff(uint32_t ms)
+{
+    if (ms > BACKOFF_MAX_MS)
+        ms = BACKOFF_MAX_MS;
+    portENTER_CRITICAL(&s_mux);
+    refill();
+    s_level = (s_level < 0 ? s_level : 0) - (int32_t)ms;
+    if (s_level < -BACKOFF_MAX_MS)
+        s_level = -BACKOFF_MAX_MS;
+    s_stats.server_throttled++;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+/**
+ * @brief The refill is held after a 429. A request that can't wait that
+ * long should fail instead.
+ *
+ */
+bool rate_limit_in_backoff(void)
+{
+    bool backoff;
+
+    portENTER_CRITICAL(&s_mux);
+    refill();
+    backoff = s_level < 0;
+    portEXIT_CRITICAL(&s_mux);
+    return backoff;
+}
+
+void rate_limit_stats(rate_limit_stats_t* stats)
+{
+    portENTER_CRITICAL(&s_mux);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Must hold s_mux.
+ *
+ */
+static void refill(void)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    if (!s_started) {
+        s_started = true;
+        s_last_refill = now;
+        return;
+    }
+    uint32_t elapsed_ms = pdTICKS_TO_MS(now - s_last_refill);
+    s_last_refill = now;
+    if (elapsed_ms > LEVEL_MAX - s_level) {
+        s_level = LEVEL_MAX;
+    } else {
+        s_level += elapsed_ms;
+    }
+}
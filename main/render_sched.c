@@ -0,0 +1,126 @@
+/* Includes ------------------------------------------------------------------*/
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#include "render_sched.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define FRAME_BUDGET_US   15000 /* a frame is expected to render within this time */
+#define RENDER_CPU_SHARE  25 /* max percentage of CPU time spent rendering */
+#define MIN_FRAME_MS      20 /* never render faster than 50 fps */
+#define STATS_PERIOD_MS   5000
+#define TICKS_UNTIL(t, now) ((int32_t)((t) - (now)))
+
+/* Locally scoped variables --------------------------------------------------*/
+static const char* TAG = "RENDER_SCHED";
+
+/* Private function prototypes -----------------------------------------------*/
+static void log_stats(render_sched_t* sched);
+
+/* Exported functions --------------------------------------------------------*/
+void render_sched_init(render_sched_t* sched)
+{
+    *sched = (render_sched_t) {
+        .dirty = true, /* first frame */
+        .deadline = RENDER_NO_DEADLINE,
+        .not_before = xTaskGetTickCount(),
+        .min_us = UINT32_MAX,
+        .stats_since = xTaskGetTickCount(),
+    };
+}
+
+void render_sched_invalidate(render_sched_t* sched)
+{
+    sched->dirty = true;
+}
+
+/**
+ * @brief An animation needs a frame at deadline. Only the closest deadline
+ * is kept. Animations request their next deadline on each frame they draw.
+ *
+ */
+void render_sched_request(render_sched_t* sched, TickType_t deadline)
+{
+    if (sched->deadline == RENDER_NO_DEADLINE
+        || TICKS_UNTIL(deadline, sched->deadline) < 0) {
+        sched->deadline = deadline;
+    }
+}
+
+/**
+ * @brief Ticks to sleep before the next frame is due.
+ *
+ * @retval portMAX_DELAY if nothing changed and nothing animates
+ */
+TickType_t render_sched_wait_ticks(const render_sched_t* sched)
+{
+    TickType_t due;
+
+    if (sched->dirty) {
+        due = sched->not_before;
+    } else if (sched->deadline == RENDER_NO_DEADLINE) {
+        return portMAX_DELAY;
+    } else {
+        due = TICKS_UNTIL(sched->deadline, sched->not_before) > 0 ? sched->deadline : sched->not_before;
+    }
+    int32_t wait = TICKS_UNTIL(due, xTaskGetTickCount());
+    return wait > 0 ? wait : 0;
+}
+
+/**
+ * @brief Start a frame if one is due. Deadlines are consumed, the page must
+ * request new ones while drawing.
+ *
+ * @retval true if the page has to render now
+ */
+bool render_sched_begin_frame(render_sched_t* sched)
+{
+    if (render_sched_wait_ticks(sched) != 0)
+        return false;
+
+    sched->dirty = false;
+    sched->deadline = RENDER_NO_DEADLINE;
+    sched->frame_start_us = esp_timer_get_time();
+    return true;
+}
+
+void render_sched_end_frame(render_sched_t* sched)
+{
+    uint32_t frame_us = esp_timer_get_time() - sched->frame_start_us;
+
+    sched->frames++;
+    sched->total_us += frame_us;
+    if (frame_us < sched->min_us)
+        sched->min_us = frame_us;
+    if (frame_us > sched->max_us)
+        sched->max_us = frame_us;
+    if (frame_us > FRAME_BUDGET_US)
+        sched->overruns++;
+
+    /* Keep rendering under RENDER_CPU_SHARE: a frame that took t us
+     * delays the next one at least t * (100 / share) us */
+    uint32_t pace_ms = frame_us * (100 / RENDER_CPU_SHARE) / 1000;
+    if (pace_ms < MIN_FRAME_MS)
+        pace_ms = MIN_FRAME_MS;
+    sched->not_before = xTaskGetTickCount() + pdMS_TO_TICKS(pace_ms);
+
+    log_stats(sched);
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void log_stats(render_sched_t* sched)
+{
+    TickType_t elapsed = xTaskGetTickCount() - sched->stats_since;
+    if (elapsed < pdMS_TO_TICKS(STATS_PERIOD_MS))
+        return;
+
+    ESP_LOGD(TAG, "%u frames in %u ms, frame time: min %u us, avg %u us, max %u us, %u over budget",
+        sched->frames, pdTICKS_TO_MS(elapsed), sched->min_us,
+        (uint32_t)(sched->total_us / sched->frames), sched->max_us, sched->overruns);
+
+    sched->frames = sched->overruns = sched->max_us = 0;
+    sched->total_us = 0;
+    sched->min_us = UINT32_MAX;
+    sched->stats_since = xTaskGetTickCount();
+}
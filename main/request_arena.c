@@ -0,0 +1,85 @@
+/* Includes ------------------------------------------------------------------*/
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+#include "request_arena.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Locally scoped variables --------------------------------------------------*/
+static const char* TAG = "REQUEST_ARENA";
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Carve the memory declared by budget. The block of the previous
+ * request is reused when it's big enough, otherwise a new one is taken from
+ * the heap.
+ *
+ * @retval ESP_ERR_NO_MEM if the block can't be allocated
+ */
+esp_err_t request_arena_begin(request_arena_t* req, request_budget_t* budget)
+{
+    size_t block_size = ARENA_SIZEOF(budget->buffer_size + 1) /* null terminator */
+        + ARENA_SIZEOF(budget->max_tokens * sizeof(jsmntok_t))
+        + ARENA_SIZEOF(budget->post_size);
+
+    if (req->arena.base && req->arena.size < block_size) {
+        request_arena_end(req, false);
+    }
+    if (!req->arena.base) {
+        void* block = malloc(block_size);
+        if (!block) {
+            ESP_LOGE(TAG, "%s: can't allocate %zu bytes", budget->name, block_size);
+            return ESP_ERR_NO_MEM;
+        }
+        arena_init(&req->arena, block, block_size);
+        req->block_peak = MAX(req->block_peak, block_size);
+    }
+    arena_reset(&req->arena);
+
+    req->budget = budget;
+    req->buffer_size = budget->buffer_size;
+    req->buffer = arena_alloc(&req->arena, budget->buffer_size + 1);
+    req->buffer[0] = '\0';
+    req->max_tokens = budget->max_tokens;
+    req->tokens = arena_alloc(&req->arena, budget->max_tokens * sizeof(jsmntok_t));
+    req->post_size = budget->post_size;
+    req->post = arena_alloc(&req->arena, budget->post_size);
+    req->buffer_used = req->body_len = req->received = req->tokens_used = 0;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Update the endpoint high water marks. The block goes back to the
+ * heap unless keep_block is set, e.g. while polling, to avoid a malloc/free
+ * pair on every poll.
+ *
+ */
+void request_arena_end(request_arena_t* req, bool keep_block)
+{
+    if (req->budget) {
+        req->budget->buffer_peak = MAX(req->budget->buffer_peak, req->buffer_used);
+        req->budget->tokens_peak = MAX(req->budget->tokens_peak, req->tokens_used);
+        req->budget = NULL;
+    }
+    if (!keep_block && req->arena.base) {
+        free(req->arena.base);
+        req->arena = (arena_t) { 0 };
+        req->buffer = req->post = NULL;
+        req->tokens = NULL;
+    }
+}
+
+void request_arena_log(const request_arena_t* req, request_budget_t** budgets, size_t count)
+{
+    ESP_LOGI(TAG, "block: %zu bytes held, peak %zu", req->arena.size, req->block_peak);
+    for (size_t i = 0; i < count; i++) {
+        request_budget_t* b = budgets[i];
+        ESP_LOGI(TAG, "%s: buffer %zu/%zu, tokens %u/%u", b->name,
+            b->buffer_peak, b->buffer_size, b->tokens_peak, b->max_tokens);
+    }
+}
@@ -42,6 +42,8 @@
  */
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
@@ -49,16 +51,30 @@
 #include "rotary_encoder.h"
 #include "u8g2.h"
 
+#include "display_flush.h"
+#include "input.h"
 #include "selection_list.h"
 
 /* Private macro -------------------------------------------------------------*/
 #define MY_BORDER_SIZE 1
+#define LINE_MAX_BYTES 64 /* more than a line of the display can show */
+
+/* Private types -------------------------------------------------------------*/
 
-/* Imported function prototypes ----------------------------------------------*/
-void u8g2_DrawSelectionList(u8g2_t* u8g2, u8sl_t* u8sl, u8g2_uint_t y, const char* s);
+/* Same as u8sl_t, but 16 bits wide */
+typedef struct {
+    uint16_t visible;
+    uint16_t total;
+    uint16_t first_pos;
+    uint16_t current_pos;
+} sl_view_t;
 
 /* Private function prototypes -----------------------------------------------*/
-uint8_t getMenuEvent(QueueHandle_t queue, TickType_t ticks_timeout);
+static const char* string_list_item(void* ctx, uint16_t index, uint16_t* len);
+static void        draw_visible_items(u8g2_t* u8g2, const sl_view_t* view, u8g2_uint_t y, const sl_source_t* source);
+static void        view_move(sl_view_t* view, int16_t delta);
+static void        view_next(sl_view_t* view);
+static void        view_prev(sl_view_t* view);
 
 /* Private variables ---------------------------------------------------------*/
 
@@ -72,8 +88,11 @@ uint8_t getMenuEvent(QueueHandle_t queue, TickType_t ticks_timeout);
  *        -    u8g2_SetFontDirection(u8g2, 0);
  *        -    u8g2_SetFontPosBaseline(u8g2);
  *
+ * Items are looked up by scanning sl, meant for short fixed menus. Lists
+ * built at runtime go through userInterfaceSelectionListSource().
+ *
  * @param u8g2 A pointer to the u8g2 structure
- * @param queue Handle of the rotary encoder queue
+ * @param input Reads the rotary encoder queue
  * @param title NULL for no title, valid str for title line. Can contain
  *              mutliple lines, separated by '\\n'
  * @param start_pos default position for the cursor, first line is 1.
@@ -81,14 +100,43 @@ uint8_t getMenuEvent(QueueHandle_t queue, TickType_t ticks_timeout);
  *
  * @retval - 0 if user has pressed the home key
  * @retval - The selected line if user has pressed the select key
+ * @retval - MENU_EVENT_TIMEOUT if no event arrived within ticks_timeout
+ */
+uint16_t userInterfaceSelectionList(u8g2_t* u8g2, input_t* input,
+    const char* title, uint16_t start_pos, const char* sl, TickType_t ticks_timeout)
+{
+    sl_source_t source = sl_string_source(sl);
+
+    return userInterfaceSelectionListSource(u8g2, input, title, start_pos, &source, ticks_timeout);
+}
+
+/**
+ * @brief Item source over a string list, to add a rest callback to it.
+ *
  */
-uint8_t userInterfaceSelectionList(u8g2_t* u8g2, QueueHandle_t queue,
-    const char* title, uint8_t start_pos, const char* sl, TickType_t ticks_timeout)
+sl_source_t sl_string_source(const char* sl)
 {
-    u8sl_t      u8sl;
+    return (sl_source_t) {
+        .item = string_list_item,
+        .ctx = (void*)sl,
+        .count = u8x8_GetStringLineCnt(sl),
+    };
+}
+
+/**
+ * @brief Same as userInterfaceSelectionList(), but the items are asked to
+ * source one at a time. Only the visible ones are fetched and drawn, so a
+ * redraw costs the same whatever the length of the list. If the cursor stays
+ * source->rest_ticks on an item, source->rest is called with its index.
+ *
+ */
+uint16_t userInterfaceSelectionListSource(u8g2_t* u8g2, input_t* input,
+    const char* title, uint16_t start_pos, const sl_source_t* source, TickType_t ticks_timeout)
+{
+    sl_view_t   view;
     u8g2_uint_t yy;
 
-    uint8_t event;
+    input_event_t event;
 
     u8g2_uint_t line_height = u8g2_GetAscent(u8g2) - u8g2_GetDescent(u8g2) + MY_BORDER_SIZE;
 
@@ -100,84 +148,172 @@ uint8_t userInterfaceSelectionList(u8g2_t* u8g2, QueueHandle_t queue,
 
     if (title_lines > 0) {
         display_lines = (u8g2_GetDisplayHeight(u8g2) - 3) / line_height;
-        u8sl.visible = display_lines;
-        u8sl.visible -= title_lines;
+        view.visible = display_lines;
+        view.visible -= title_lines;
     } else {
         display_lines = u8g2_GetDisplayHeight(u8g2) / line_height;
-        u8sl.visible = display_lines;
+        view.visible = display_lines;
     }
 
-    u8sl.total = u8x8_GetStringLineCnt(sl);
-    u8sl.first_pos = 0;
-    u8sl.current_pos = start_pos;
+    view.total = source->count;
+    view.first_pos = 0;
+    view.current_pos = start_pos;
 
-    if (u8sl.current_pos >= u8sl.total)
-        u8sl.current_pos = u8sl.total - 1;
-    if (u8sl.first_pos + u8sl.visible <= u8sl.current_pos)
-        u8sl.first_pos = u8sl.current_pos - u8sl.visible + 1;
+    if (view.current_pos >= view.total)
+        view.current_pos = view.total ? view.total - 1 : 0;
+    if (view.first_pos + view.visible <= view.current_pos)
+        view.first_pos = view.current_pos - view.visible + 1;
 
     u8g2_SetFontPosBaseline(u8g2);
 
     for (;;) {
-        u8g2_FirstPage(u8g2);
-        do {
-            yy = u8g2_GetAscent(u8g2);
-            if (title_lines > 0) {
-                yy += u8g2_DrawUTF8Lines(u8g2, 0, yy, u8g2_GetDisplayWidth(u8g2), line_height, title);
+        /* full buffer mode: draw once, then send only what changed */
+        u8g2_ClearBuffer(u8g2);
+        yy = u8g2_GetAscent(u8g2);
+        if (title_lines > 0) {
+            yy += u8g2_DrawUTF8Lines(u8g2, 0, yy, u8g2_GetDisplayWidth(u8g2), line_height, title);
 
-                u8g2_DrawHLine(u8g2, 0, yy - line_height - u8g2_GetDescent(u8g2) + 1, u8g2_GetDisplayWidth(u8g2));
+            u8g2_DrawHLine(u8g2, 0, yy - line_height - u8g2_GetDescent(u8g2) + 1, u8g2_GetDisplayWidth(u8g2));
 
-                yy += 3;
-            }
-            u8g2_DrawSelectionList(u8g2, &u8sl, yy, sl);
-        } while (u8g2_NextPage(u8g2));
+            yy += 3;
+        }
+        draw_visible_items(u8g2, &view, yy, source);
+        display_flush(u8g2);
 
 #ifdef U8G2_REF_MAN_PIC
         return 0;
 #endif
 
+        /* the timeout counts from the last move, the rest wait included */
+        TickType_t left = ticks_timeout;
+        bool       rested = !source->rest || !view.total;
         for (;;) {
-            event = getMenuEvent(queue, ticks_timeout);
-            if (event == U8X8_MSG_GPIO_MENU_SELECT)
-                return u8sl.current_pos + 1; /* +1, issue 112 */
-            else if (event == U8X8_MSG_GPIO_MENU_HOME)
+            TickType_t ticks = left;
+            if (!rested && (left == portMAX_DELAY || source->rest_ticks < left))
+                ticks = source->rest_ticks;
+            if (!input_read(input, &event, ticks)) {
+                if (ticks == left)
+                    return MENU_EVENT_TIMEOUT;
+                rested = true;
+                source->rest(source->ctx, view.current_pos);
+                if (left != portMAX_DELAY)
+                    left -= ticks;
+                continue;
+            }
+            if (event.type == BUTTON_EVENT) {
+                if (event.btn_event == SHORT_PRESS)
+                    return view.total ? view.current_pos + 1 : 0; /* +1, issue 112 */
                 return 0; /* issue 112: return 0 instead of start_pos */
-            else if (event == U8X8_MSG_GPIO_MENU_NEXT || event == U8X8_MSG_GPIO_MENU_DOWN) {
-                u8sl_Next(&u8sl);
-                break;
-            } else if (event == U8X8_MSG_GPIO_MENU_PREV || event == U8X8_MSG_GPIO_MENU_UP) {
-                u8sl_Prev(&u8sl);
+            }
+            if (event.delta) { /* all the detents queued, one redraw */
+                view_move(&view, event.delta);
                 break;
-            } else if (event == MENU_EVENT_TIMEOUT) {
-                return MENU_EVENT_TIMEOUT;
             }
         }
     }
 }
 
 /* Private functions ---------------------------------------------------------*/
-uint8_t getMenuEvent(QueueHandle_t queue, TickType_t ticks_timeout)
+/**
+ * @brief Item source over a string list, ctx is the list.
+ *
+ */
+static const char* string_list_item(void* ctx, uint16_t index, uint16_t* len)
 {
-    rotary_encoder_event_t queue_event = { 0 };
-
-    if (pdTRUE == xQueueReceive(queue, &queue_event, ticks_timeout)) {
-        if (queue_event.event_type == BUTTON_EVENT) {
-            switch (queue_event.btn_event) {
-            case SHORT_PRESS:
-                return U8X8_MSG_GPIO_MENU_SELECT;
-            case MEDIUM_PRESS:
-            case LONG_PRESS:
-                return U8X8_MSG_GPIO_MENU_HOME;
-            }
-        } else { /* ROTARY_ENCODER_EVENT */
-            return queue_event.re_state.direction == ROTARY_ENCODER_DIRECTION_CLOCKWISE
-                ? U8X8_MSG_GPIO_MENU_NEXT
-                : U8X8_MSG_GPIO_MENU_PREV;
+    const char* line = u8x8_GetStringLineStart(index, ctx);
+
+    if (line == NULL)
+        return NULL;
+    const char* end = strchr(line, '\n');
+    *len = end ? end - line : strlen(line);
+    return line;
+}
+
+/**
+ * @brief Like u8g2_DrawSelectionList(), but only the visible items are
+ * asked to the source. Each one is copied to a line buffer to terminate it,
+ * cut at LINE_MAX_BYTES without splitting an UTF-8 sequence.
+ *
+ */
+static void draw_visible_items(u8g2_t* u8g2, const sl_view_t* view, u8g2_uint_t y, const sl_source_t* source)
+{
+    u8g2_uint_t line_height = u8g2_GetAscent(u8g2) - u8g2_GetDescent(u8g2) + MY_BORDER_SIZE;
+    char        line[LINE_MAX_BYTES];
+
+    for (uint16_t idx = view->first_pos; idx < view->total && idx < view->first_pos + view->visible; idx++) {
+        uint16_t    len = 0;
+        const char* item = source->item(source->ctx, idx, &len);
+        if (item == NULL) { /* memcpy() doesn't take NULL, even for 0 bytes */
+            item = "";
+            len = 0;
         }
+        if (len >= sizeof(line)) {
+            len = sizeof(line) - 1;
+            while (len > 0 && (item[len] & 0xC0) == 0x80) /* continuation byte */
+                len--;
+        }
+        memcpy(line, item, len);
+        line[len] = '\0';
+
+        uint8_t selected = idx == view->current_pos;
+        u8g2_DrawUTF8Line(u8g2, MY_BORDER_SIZE, y, u8g2_GetDisplayWidth(u8g2) - 2 * MY_BORDER_SIZE,
+            line, selected ? MY_BORDER_SIZE : 0, selected);
+        y += line_height;
+    }
+}
+
+/**
+ * @brief Move the cursor delta items. A single step wraps around like
+ * u8sl_Next() and u8sl_Prev(), an accelerated one stops at the ends.
+ *
+ */
+static void view_move(sl_view_t* view, int16_t delta)
+{
+    if (delta == 1)
+        return view_next(view);
+    if (delta == -1)
+        return view_prev(view);
+    if (view->total == 0)
+        return;
+
+    int32_t pos = (int32_t)view->current_pos + delta;
+    if (pos < 0) {
+        pos = 0;
+    } else if (pos >= view->total) {
+        pos = view->total - 1;
+    }
+    view->current_pos = pos;
+    if (view->first_pos > view->current_pos) {
+        view->first_pos = view->current_pos;
+    } else if (view->first_pos + view->visible <= view->current_pos) {
+        view->first_pos = view->current_pos - view->visible + 1;
+    }
+}
+
+/* u8sl_Next() and u8sl_Prev(), for 16 bit positions */
+static void view_next(sl_view_t* view)
+{
+    view->current_pos++;
+    if (view->current_pos >= view->total) {
+        view->current_pos = 0;
+        view->first_pos = 0;
+    } else if (view->first_pos + view->visible <= view->current_pos) {
+        view->first_pos = view->current_pos - view->visible + 1;
+    }
+}
+
+static void view_prev(sl_view_t* view)
+{
+    if (view->total == 0)
+        return;
+    if (view->current_pos == 0) {
+        view->current_pos = view->total - 1;
+        view->first_pos = view->total > view->visible ? view->total - view->visible : 0;
     } else {
-        return MENU_EVENT_TIMEOUT;
+        view->current_pos--;
+        if (view->first_pos > view->current_pos)
+            view->first_pos = view->current_pos;
     }
-    return 0; /* invalid message, no event */
 }
 
 /***************************** END OF FILE ************************************/
@@ -4,22 +4,26 @@
 #include "esp_log.h"
 #include "esp_spiffs.h"
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include <stdio.h>
 #include <sys/unistd.h>
 
 /* Private function prototypes -----------------------------------------------*/
 int static inline spiffs_init();
+static SemaphoreHandle_t mount_lock();
 
 /* Private variables ---------------------------------------------------------*/
 static const char* TAG = "spiffs_wifi";
+static uint8_t     s_mount_count = 0; /* users of the mounted partition, guarded by mount_lock() */
 
 /* Exported functions --------------------------------------------------------*/
 int wifi_config_read(wifi_config_t* wifi_config)
 {
     ESP_LOGD(TAG, "Initializing SPIFFS for read");
 
-    assert(spiffs_init() == ESP_OK);
+    assert(spiffs_mount() == ESP_OK);
 
     // Use POSIX and C standard library functions to work with files.
     // First create a file.
@@ -27,14 +31,14 @@ int wifi_config_read(wifi_config_t* wifi_config)
     FILE* f = fopen("/spiffs/wifi_config.txt", "r");
     if (f == NULL) {
         ESP_LOGE(TAG, "Failed to open file for reading");
-        esp_vfs_spiffs_unregister(NULL);
+        spiffs_unmount();
         return CONFIG_NOT_FOUND;
     }
     fread(wifi_config, sizeof(wifi_config_t), 1, f);
     fclose(f);
 
     // All done, unmount partition and disable SPIFFS
-    esp_vfs_spiffs_unregister(NULL);
+    spiffs_unmount();
     return CONFIG_FOUND;
 }
 
@@ -42,7 +46,7 @@ int wifi_config_write(wifi_config_t* wifi_config)
 {
     ESP_LOGD(TAG, "Initializing SPIFFS for write");
 
-    assert(spiffs_init() == ESP_OK);
+    assert(spiffs_mount() == ESP_OK);
 
     ESP_LOGD(TAG, "Opening file");
     FILE* f = fopen("/spiffs/wifi_config.txt", "w");
@@ -52,13 +56,13 @@ int wifi_config_write(wifi_config_t* wifi_config)
     fwrite(wifi_config, sizeof(wifi_config_t), 1, f);
     fclose(f);
 
-    esp_vfs_spiffs_unregister(NULL);
+    spiffs_unmount();
     return ESP_OK;
 }
 
 int wifi_config_delete()
 {
-    assert(spiffs_init() == ESP_OK);
+    assert(spiffs_mount() == ESP_OK);
 
     int res = unlink("/spiffs/wifi_config.txt");
     if (res == ESP_OK) {
@@ -66,16 +70,63 @@ int wifi_config_delete()
     } else {
         ESP_LOGW(TAG, "Error: unable to delete the file");
     }
-    esp_vfs_spiffs_unregister(NULL);
+    spiffs_unmount();
     return res;
 }
 
+/**
+ * @brief Mount the partition, unless it is already mounted. The font keeps
+ * it mounted, so each user pairs this call with spiffs_unmount(). The font
+ * and the wifi config are read from different tasks at boot, the count and
+ * the (un)registration are done under a lock.
+ *
+ */
+esp_err_t spiffs_mount()
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(mount_lock(), portMAX_DELAY);
+    if (s_mount_count == 0 && spiffs_init() != ESP_OK) {
+        err = ESP_FAIL;
+    } else {
+        s_mount_count++;
+    }
+    xSemaphoreGive(mount_lock());
+    return err;
+}
+
+void spiffs_unmount()
+{
+    xSemaphoreTake(mount_lock(), portMAX_DELAY);
+    assert(s_mount_count > 0);
+    if (--s_mount_count == 0)
+        esp_vfs_spiffs_unregister(NULL);
+    xSemaphoreGive(mount_lock());
+}
+
+/**
+ * @brief The mutex is created by the first caller, whatever task it is.
+ *
+ */
+static SemaphoreHandle_t mount_lock()
+{
+    static portMUX_TYPE      s_mux = portMUX_INITIALIZER_UNLOCKED;
+    static StaticSemaphore_t s_lock_buf;
+    static SemaphoreHandle_t s_lock = NULL;
+
+    portENTER_CRITICAL(&s_mux);
+    if (!s_lock)
+        s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+    portEXIT_CRITICAL(&s_mux);
+    return s_lock;
+}
+
 int static inline spiffs_init()
 {
     esp_vfs_spiffs_conf_t conf = {
         .base_path = "/spiffs",
         .partition_label = NULL,
-        .max_files = 1,
+        .max_files = 2, /* the font file stays open */
         .format_if_mount_failed = true
     };
 
@@ -1,20 +1,26 @@
 /* Includes ------------------------------------------------------------------*/
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "esp_http_client.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "freertos/event_groups.h"
 #include "limits.h"
 
 #include "credentials.h"
 #include "display.h"
 #include "handler_callbacks.h"
+#include "rate_limit.h"
 #include "spotifyclient.h"
 
 /* Private macro -------------------------------------------------------------*/
 #define PLAYER              "/me/player"
 #define TOKEN_URL           "https://accounts.spotify.com/api/token"
 #define PLAYING             PLAYER "?market=AR&additional_types=episode"
+#define CURRENTLY_PLAYING   PLAYER "/currently-playing?market=AR&additional_types=episode"
 #define PLAY                PLAYER "/play"
 #define PAUSE               PLAYER "/pause"
 #define PREV                PLAYER "/previous"
@@ -24,76 +30,166 @@
 #define ACQUIRE_LOCK(mux)   xSemaphoreTake(mux, portMAX_DELAY)
 #define RELEASE_LOCK(mux)   xSemaphoreGive(mux)
 #define RETRIES_ERR_CONN    3
-#define SPRINTF_BUF_SIZE    100
+#define FULL_REFRESH_CYCLES 6 /* light polls between two full player state polls */
+#define SEEK_TOLERANCE_MS   3000 /* progress off by more than this from the expected one is a seek */
+#define POLL_DEADLINE_MS    8000 /* a poll taking longer is dropped, the next one comes anyway */
+#define LIST_DEADLINE_MS    15000
+#define LIST_PLAYLISTS      (1 << 0)
+#define LIST_DEVICES        (1 << 1)
 
 /* -"204" on "GET /me/player" means the actual device is inactive
  * -"204" on "PUT /me/player" means playback sucessfuly transfered
  *   to an active device (although my Sangean returns 202) */
-#define DEVICE_INACTIVE(state) (                  \
-    !strcmp(s_state.endpoint, PLAYERURL(PLAYING)) \
-    && s_state.method == HTTP_METHOD_GET && s_state.status_code == 204)
+#define DEVICE_INACTIVE(lane) (                     \
+    !strcmp((lane)->endpoint, PLAYERURL(PLAYING)) \
+    && (lane)->method == HTTP_METHOD_GET && (lane)->status_code == 204)
 
-#define PLAYBACK_TRANSFERED(state) (             \
-    !strcmp(s_state.endpoint, PLAYERURL(PLAYER)) \
-    && s_state.method == HTTP_METHOD_PUT         \
-    && (s_state.status_code == 204 || s_state.status_code == 202))
+/* "currently-playing" lacks the device object, only progress,
+ * play state and item are read from it */
+#define LIGHT_POLL(lane) (!strcmp((lane)->endpoint, PLAYERURL(CURRENTLY_PLAYING)))
 
-#define PREPARE_CLIENT(state, AUTH, TYPE)                              \
-    esp_http_client_set_url(s_state.client, s_state.endpoint);         \
-    esp_http_client_set_method(s_state.client, s_state.method);        \
-    esp_http_client_set_header(s_state.client, "Authorization", AUTH); \
-    esp_http_client_set_header(s_state.client, "Content-Type", TYPE)
+#define PLAYBACK_TRANSFERED(lane) (              \
+    !strcmp((lane)->endpoint, PLAYERURL(PLAYER)) \
+    && (lane)->method == HTTP_METHOD_PUT         \
+    && ((lane)->status_code == 204 || (lane)->status_code == 202))
+
+#define PREPARE_CLIENT(lane, TYPE)                               \
+    esp_http_client_set_url((lane)->client, (lane)->endpoint);  \
+    esp_http_client_set_method((lane)->client, (lane)->method); \
+    set_auth_header(lane);                                      \
+    esp_http_client_set_header((lane)->client, "Content-Type", TYPE)
 
 #define SWAP_PTRS(pt1, pt2) \
     TrackInfo* temp = pt1;  \
     pt1 = pt2;              \
     pt2 = temp
 
+/* Take the memory declared by the endpoint budget along with the client. While
+ * polling, the block is kept between requests instead of going back to the heap.
+ * Evaluates to ESP_ERR_NO_MEM, with the lane released, if the block can't be
+ * taken */
+/* deadline_ms 0: no deadline */
+#define BEGIN_REQUEST(lane, budget, cls, deadline_ms) \
+    lane_begin(lane, &(budget), cls, deadline_ms)
+
+#define END_REQUEST(lane)                                \
+    request_arena_end(&(lane)->req, (lane)->keep_block); \
+    lane_release(lane)
+
+#define CONTROL_IDLE_BIT      (1 << 0) /* no request in flight on the control lane */
+#define BACKGROUND_CANCEL_BIT (1 << 1) /* abort the background request, cleared by send_list_requests() */
+
+#define RETRY_AFTER_DEFAULT_MS 5000 /* a 429 without Retry-After */
+
 /* DRY macros */
 #define CALLOC(var, size)  \
     var = calloc(1, size); \
     assert((var) && "Error allocating memory")
 
 /* Private types -------------------------------------------------------------*/
-typedef void (*handler_cb_t)(char*, esp_http_client_event_t*);
+typedef void (*handler_cb_t)(request_arena_t*, esp_http_client_event_t*);
 
+typedef enum {
+    ABORT_NONE,
+    ABORT_CANCELLED, /*!< A newer user intent made it obsolete */
+    ABORT_DEADLINE,
+    ABORT_BACKOFF, /*!< The server asked to wait, a command fails instead */
+} abort_t;
+
+typedef struct {
+    uint32_t   cycles; /*!< Poll cycles, an escalated light poll counts once */
+    uint32_t   full_polls; /*!< Requests to "/me/player" */
+    uint32_t   light_polls; /*!< Requests to "/me/player/currently-playing" */
+    uint64_t   full_bytes;
+    uint64_t   light_bytes;
+    TickType_t since; /*!< Tick count of the first poll */
+} poll_stats_t;
+
+/* A lane is an http client with its own connection, request memory and
+ * handler context, so requests on different lanes don't wait for each other */
 typedef struct {
-    Tokens                   tokens; /*!<*/
+    const char*              name;
     const char*              endpoint; /*!<*/
     int                      status_code; /*!<*/
     esp_err_t                err; /*!<*/
     esp_http_client_method_t method; /*!<*/
     esp_http_client_handle_t client; /*!<*/
     handler_cb_t             handler_cb; /*!< Callback function to handle http events */
+    request_arena_t          req; /*!< Memory of the request in flight */
+    SemaphoreHandle_t        lock; /*!< Taken for the whole request */
+    bool                     keep_block; /*!< Keep the request block between requests */
+    uint8_t                  retries; /*!< Retries on error connections */
+    EventBits_t              cancel_bit; /*!< Aborts the request when set, 0 if it can't be */
+    TickType_t               started; /*!< Tick the request began */
+    uint32_t                 deadline_ms; /*!< Aborted past it, 0 if none */
+    rate_class_t             rate_class; /*!< Priority for the rate limiter */
+    uint32_t                 retry_after_ms; /*!< Retry-After of a 429, 0 if none */
+    bool                     refreshing_token; /*!< Not abortable meanwhile */
+    abort_t                  aborted; /*!< The rest of the response is dropped */
 } Client_state_t;
 
 /* Locally scoped variables --------------------------------------------------*/
-static const char*       TAG = "SPOTIFY_CLIENT";
-static char              http_buffer[MAX_HTTP_BUFFER];
-static char              sprintf_buf[SPRINTF_BUF_SIZE];
-static SemaphoreHandle_t client_lock = NULL; /* Mutex to manage access to the http client handle */
-static uint8_t           s_retries = 0; /* number of retries on error connections */
-static Client_state_t    s_state = { .tokens.access_token = { 'B', 'e', 'a', 'r', 'e', 'r', ' ', '\0' } };
-static const char*       HTTP_METHOD_LOOKUP[] = { "GET", "POST", "PUT" };
+static const char*        TAG = "SPOTIFY_CLIENT";
+static Client_state_t     s_control = { .name = "control" }; /* play/pause/skip, volume, transfer */
+static Client_state_t     s_background = { .name = "background", .cancel_bit = BACKGROUND_CANCEL_BIT }; /* polling and lists */
+static Client_state_t*    LANES[] = { &s_control, &s_background };
+static EventGroupHandle_t s_lane_events = NULL; /* CONTROL_IDLE_BIT */
+static Tokens             s_tokens = { .access_token = { 'B', 'e', 'a', 'r', 'e', 'r', ' ', '\0' } };
+static SemaphoreHandle_t  s_token_lock = NULL; /* guards s_tokens, shared by the lanes */
+static SemaphoreHandle_t  s_list_lock = NULL; /* a cancel and a dequeue of s_list_requests don't interleave */
+static const char*        HTTP_METHOD_LOOKUP[] = { "GET", "POST", "PUT" };
+static const char*        ABORT_LOOKUP[] = { "none", "cancelled", "deadline", "backoff" };
+static TrackInfo          s_tracks[2]; /* double buffer: the published snapshot and the one being parsed */
+static player_digest_t    s_digest; /* digest of the last fully parsed player state */
+static atomic_bool        s_full_refresh = true; /* next poll must fetch the full player state */
+static uint8_t            s_light_polls = 0; /* light polls since the last full one */
+static poll_stats_t       s_poll_stats;
+static atomic_int         s_volume_request = -1; /* volume for the player task to send, -1 if none */
+static atomic_uint        s_list_requests; /* LIST_ bits, lists for the player task to fetch */
+static atomic_uint        s_playlists_generation; /* of the last playlists fetch asked */
+static atomic_uint        s_devices_generation; /* of the last devices fetch asked */
+static TickType_t         s_progress_tick; /* when s_track->progress_ms was received */
+static TrackInfo* _Atomic s_track = &s_tracks[0]; /* published snapshot */
+static atomic_uint        s_track_seq; /* odd while the published snapshot is written */
+static portMUX_TYPE       s_track_mux = portMUX_INITIALIZER_UNLOCKED; /* serializes the writers */
+
+/* Worst case needs of each endpoint: response body, json tokens and payload.
+ * A token refresh may run inside any request, so every budget covers it */
+static request_budget_t PLAYER_BUDGET = { .name = "player", .buffer_size = 8192, .max_tokens = 500, .post_size = 100 };
+static request_budget_t PLAYLISTS_BUDGET = { .name = "playlists", .buffer_size = 4096, .max_tokens = 200 };
+static request_budget_t DEVICES_BUDGET = { .name = "devices", .buffer_size = 4096, .max_tokens = 200 };
+static request_budget_t COMMAND_BUDGET = { .name = "command", .buffer_size = 1024, .max_tokens = 16, .post_size = 100 };
+static request_budget_t* BUDGETS[] = { &PLAYER_BUDGET, &PLAYLISTS_BUDGET, &DEVICES_BUDGET, &COMMAND_BUDGET };
 
 /* Globally scoped variables definitions -------------------------------------*/
 TaskHandle_t PLAYER_TASK = NULL;
-TrackInfo*   TRACK = &(TrackInfo) { 0 }; /* pointer to an unnamed object, constructed in place
-by the the COMPOUND LITERAL expression "(TrackInfo) { 0 }". NOTE: Although the syntax of a compound
-literal is similar to a cast, the important distinction is that a cast is a non-lvalue expression
-while a compound literal is an lvalue */
 
 /* External variables --------------------------------------------------------*/
 extern const char spotify_cert_pem_start[] asm("_binary_spotify_cert_pem_start");
 extern const char spotify_cert_pem_end[] asm("_binary_spotify_cert_pem_end");
 
 /* Private function prototypes -----------------------------------------------*/
-static esp_err_t validate_token();
+static void      lane_acquire(Client_state_t* lane, rate_class_t cls, uint32_t deadline_ms);
+static esp_err_t lane_begin(Client_state_t* lane, request_budget_t* budget, rate_class_t cls, uint32_t deadline_ms);
+static void      lane_release(Client_state_t* lane);
+static esp_err_t perform(Client_state_t* lane);
+static abort_t   request_obsolete(Client_state_t* lane);
+static abort_t   take_token(Client_state_t* lane, rate_class_t cls);
+static esp_err_t validate_token(Client_state_t* lane);
+static esp_err_t refresh_token(Client_state_t* lane);
+static void      set_auth_header(Client_state_t* lane);
 static esp_err_t _http_event_handler(esp_http_client_event_t* evt);
 static void      player_task(void* pvParameters);
-static void      free_track(TrackInfo* track);
-static void      handle_track_fetched(TrackInfo** new_track);
-static void      handle_err_connection();
+static bool      handle_track_fetched(TrackInfo** new_track);
+static void      account_poll();
+static void      send_volume_request();
+static void      send_list_requests();
+static uint16_t  update_playback(time_t progress_ms, bool is_playing);
+static bool      seeked(const TrackInfo* prev, time_t progress_ms);
+static void      notify_track(uint16_t changes);
+static void      track_write_begin();
+static void      track_write_end();
+static bool      handle_err_connection(Client_state_t* lane);
 static void      debug_mem();
 
 /* Exported functions --------------------------------------------------------*/
@@ -105,16 +201,26 @@ void spotify_client_init(UBaseType_t priority)
         .cert_pem = spotify_cert_pem_start,
     };
 
-    // strcpy(s_state.tokens.access_token, "Bearer ");
-    CALLOC(TRACK->name, 1);
-
-    s_state.client = esp_http_client_init(&config);
-    assert(s_state.client && "Error on esp_http_client_init()");
-
-    client_lock = xSemaphoreCreateMutex();
-    assert(client_lock && "Error on xSemaphoreCreateMutex()");
+    track_info_init(&s_tracks[0]);
+    track_info_init(&s_tracks[1]);
+
+    for (size_t i = 0; i < sizeof(LANES) / sizeof(LANES[0]); i++) {
+        Client_state_t* lane = LANES[i];
+        config.user_data = lane; /* the event handler finds its lane */
+        lane->client = esp_http_client_init(&config);
+        assert(lane->client && "Error on esp_http_client_init()");
+        lane->lock = xSemaphoreCreateMutex();
+        assert(lane->lock && "Error on xSemaphoreCreateMutex()");
+        lane->handler_cb = default_http_event_handler;
+    }
 
-    s_state.handler_cb = default_http_event_handler;
+    s_token_lock = xSemaphoreCreateMutex();
+    assert(s_token_lock && "Error on xSemaphoreCreateMutex()");
+    s_list_lock = xSemaphoreCreateMutex();
+    assert(s_list_lock && "Error on xSemaphoreCreateMutex()");
+    s_lane_events = xEventGroupCreate();
+    assert(s_lane_events && "Error on xEventGroupCreate()");
+    xEventGroupSetBits(s_lane_events, CONTROL_IDLE_BIT);
 
     init_functions_cb();
 
@@ -122,278 +228,789 @@ void spotify_client_init(UBaseType_t priority)
     assert((res == pdPASS) && "Error creating task");
 }
 
-void player_cmd(rotary_encoder_event_t* event)
+/**
+ * @brief Start reading the published snapshot, without locking:
+ *
+ *     do {
+ *         track = track_read_begin(&seq);
+ *         ... copy what is needed, bounded ...
+ *     } while (track_read_retry(seq));
+ *
+ * The poller may rewrite the snapshot meanwhile, then the copy is garbage
+ * and must be read again. The strings always lie on the static buffers of
+ * the snapshots, but may be unterminated while rewritten, so copy them with
+ * a size bound and use them only once the section is validated.
+ *
+ */
+const TrackInfo* track_read_begin(uint32_t* seq)
 {
-    Player_cmd_t cmd;
+    uint32_t s;
+
+    /* writes are a few stores under a spinlock, the writer is never
+     * preempted by this core, only the other one can be in there */
+    while ((s = atomic_load_explicit(&s_track_seq, memory_order_acquire)) & 1)
+        ;
+    *seq = s;
+    return s_track;
+}
+
+/**
+ * @retval true if the snapshot changed since track_read_begin(), what was
+ * read must be discarded
+ */
+bool track_read_retry(uint32_t seq)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s_track_seq, memory_order_relaxed) != seq;
+}
+
+void player_cmd(Player_cmd_t cmd)
+{
+    Client_state_t*          lane = &s_control;
+    esp_http_client_method_t method;
+    const char*              endpoint;
+    const TrackInfo*         track;
+    uint32_t                 seq;
+    bool                     is_playing;
 
-    if (event->event_type == BUTTON_EVENT) {
-        cmd = cmdToggle;
-    } else {
-        cmd = event->re_state.direction == ROTARY_ENCODER_DIRECTION_CLOCKWISE ? cmdPrev : cmdNext;
-    }
     switch (cmd) {
     case cmdToggle:
-        s_state.method = HTTP_METHOD_PUT;
-        s_state.endpoint = TRACK->isPlaying ? PLAYERURL(PAUSE) : PLAYERURL(PLAY);
+        do {
+            track = track_read_begin(&seq);
+            is_playing = track->isPlaying;
+        } while (track_read_retry(seq));
+        method = HTTP_METHOD_PUT;
+        endpoint = is_playing ? PLAYERURL(PAUSE) : PLAYERURL(PLAY);
         break;
     case cmdPrev:
-        s_state.method = HTTP_METHOD_POST;
-        s_state.endpoint = PLAYERURL(PREV);
+        method = HTTP_METHOD_POST;
+        endpoint = PLAYERURL(PREV);
         break;
     case cmdNext:
-        s_state.method = HTTP_METHOD_POST;
-        s_state.endpoint = PLAYERURL(NEXT);
+        method = HTTP_METHOD_POST;
+        endpoint = PLAYERURL(NEXT);
         break;
     default:
         ESP_LOGE(TAG, "unknow command");
         return;
     }
 
-    ACQUIRE_LOCK(client_lock);
-    validate_token();
-    s_state.handler_cb = default_http_event_handler;
+    if (ESP_OK != BEGIN_REQUEST(lane, COMMAND_BUDGET, RATE_COMMAND, 0)) {
+        send_err("Out of memory");
+        return;
+    }
+    validate_token(lane);
+    lane->handler_cb = default_http_event_handler;
+    lane->method = method;
+    lane->endpoint = endpoint;
 
-    PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
+    PREPARE_CLIENT(lane, "application/json");
 retry:
-    ESP_LOGD(TAG, "Endpoint to send: %s", s_state.endpoint);
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
-    int length = esp_http_client_get_content_length(s_state.client);
-
-    if (s_state.err == ESP_OK) {
-        s_retries = 0;
-        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", s_state.status_code, length);
+    ESP_LOGD(TAG, "Endpoint to send: %s", lane->endpoint);
+    perform(lane);
+    int length = esp_http_client_get_content_length(lane->client);
+
+    if (lane->err == ESP_OK) {
+        lane->retries = 0;
+        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", lane->status_code, length);
         if (cmd == cmdToggle) {
             /* If for any reason, we dont have the actual state
              * of the player, then when sending play command when
              * paused, or viceversa, we receive error 403. */
-            if (s_state.status_code == 403) {
-                if (strcmp(s_state.endpoint, PLAYERURL(PLAY)) == 0) {
-                    s_state.endpoint = PLAYERURL(PAUSE);
+            if (lane->status_code == 403) {
+                if (strcmp(lane->endpoint, PLAYERURL(PLAY)) == 0) {
+                    lane->endpoint = PLAYERURL(PAUSE);
                 } else {
-                    s_state.endpoint = PLAYERURL(PLAY);
+                    lane->endpoint = PLAYERURL(PLAY);
                 }
-                esp_http_client_set_url(s_state.client, s_state.endpoint);
+                esp_http_client_set_url(lane->client, lane->endpoint);
                 goto retry; // add max number of retries maybe
             } else { /* all ok?? */
-                TRACK->isPlaying = !TRACK->isPlaying;
+                track_write_begin();
+                s_track->isPlaying = !s_track->isPlaying;
+                track_write_end();
             }
         } else {
             /* The command was prev or next, change track in progress */
             vTaskDelay(pdMS_TO_TICKS(1000)); /* wait for the server to update the current track */
             UNBLOCK_PLAYER_TASK; /* unblock task before reach MS_NOTIF_POLLING timeout */
         }
-    } else {
-        handle_err_connection();
+    } else if (handle_err_connection(lane)) {
         goto retry;
     }
 
-    RELEASE_LOCK(client_lock);
+    END_REQUEST(lane);
 
     ESP_LOGD(TAG, "[PLAYER-TASK]: stack watermark: %d", uxTaskGetStackHighWaterMark(NULL));
 }
 
-void http_user_playlists()
+void http_user_playlists(uint32_t generation)
 {
-    ACQUIRE_LOCK(client_lock);
-    validate_token();
-    s_state.handler_cb = playlists_handler;
-    s_state.method = HTTP_METHOD_GET;
-    s_state.endpoint = PLAYERURL("/me/playlists?offset=0&limit=50");
+    Client_state_t* lane = &s_background;
 
-    PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
+    if (ESP_OK != BEGIN_REQUEST(lane, PLAYLISTS_BUDGET, RATE_LIST, LIST_DEADLINE_MS)) {
+        NOTIFY_DISPLAY_LIST(PLAYLISTS_FAILED, generation);
+        return;
+    }
+    validate_token(lane);
+    lane->handler_cb = playlists_handler;
+    lane->method = HTTP_METHOD_GET;
+    lane->endpoint = PLAYERURL("/me/playlists?offset=0&limit=50");
+    /* what an aborted fetch left */
+    strTableClear(&PLAYLISTS.names);
+    strTableClear(&PLAYLISTS.values);
+
+    PREPARE_CLIENT(lane, "application/json");
 retry:
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
-    if (s_state.err == ESP_OK) {
-        s_retries = 0;
-    } else {
-        handle_err_connection();
+    perform(lane);
+    if (lane->err == ESP_OK) {
+        lane->retries = 0;
+    } else if (handle_err_connection(lane)) {
         goto retry;
     }
-    RELEASE_LOCK(client_lock);
+    abort_t aborted = lane->aborted;
+    END_REQUEST(lane);
+    if (aborted == ABORT_CANCELLED) /* nobody waits for it */
+        return;
+    NOTIFY_DISPLAY_LIST(aborted == ABORT_DEADLINE ? PLAYLISTS_TIMED_OUT : playlists_handler_result(),
+        generation);
 }
 
-void http_available_devices()
+void http_available_devices(uint32_t generation)
 {
-    ACQUIRE_LOCK(client_lock);
-    validate_token();
-    s_state.handler_cb = default_http_event_handler;
-    s_state.endpoint = PLAYERURL(PLAYER "/devices");
-    s_state.method = HTTP_METHOD_GET;
-    PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
-
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
-    esp_http_client_set_post_field(s_state.client, NULL, 0);
+    Client_state_t* lane = &s_background;
 
-    ESP_LOGW(TAG, "Active devices:\n%s", http_buffer);
+    if (ESP_OK != BEGIN_REQUEST(lane, DEVICES_BUDGET, RATE_LIST, LIST_DEADLINE_MS)) {
+        NOTIFY_DISPLAY_LIST(DEVICES_FAILED, generation);
+        return;
+    }
+    validate_token(lane);
+    lane->handler_cb = default_http_event_handler;
+    lane->endpoint = PLAYERURL(PLAYER "/devices");
+    lane->method = HTTP_METHOD_GET;
+    strTableClear(&DEVICES.names);
+    strTableClear(&DEVICES.values);
+    bool token_refreshed = false;
+
+prepare:
+    PREPARE_CLIENT(lane, "application/json");
+retry:
+    perform(lane);
+    esp_http_client_set_post_field(lane->client, NULL, 0);
+    if (lane->err == ESP_OK) {
+        lane->retries = 0;
+        if (lane->status_code == 401 && !token_refreshed) { /* bad token or expired */
+            ESP_LOGW(TAG, "Token rejected, getting a new one");
+            token_refreshed = true;
+            refresh_token(lane);
+            goto prepare;
+        }
+    } else if (handle_err_connection(lane)) {
+        goto retry;
+    }
 
-    esp_err_t err = parse_available_devices(http_buffer);
+    abort_t                aborted = lane->aborted;
+    spotify_client_event_t result = DEVICES_FAILED;
+    if (!aborted && lane->err == ESP_OK && lane->status_code == 200) {
+        ESP_LOGW(TAG, "Active devices:\n%s", lane->req.buffer);
+        result = ESP_OK == parse_available_devices(&lane->req) ? ACTIVE_DEVICES_FOUND : NO_ACTIVE_DEVICES;
+    } else if (!aborted) { /* a 429 or another error, the body isn't the list */
+        ESP_LOGE(TAG, "Devices not fetched: %s, status code: %d", esp_err_to_name(lane->err),
+            lane->status_code);
+    }
 
-    RELEASE_LOCK(client_lock);
-    (ESP_OK == err) ? NOTIFY_DISPLAY(ACTIVE_DEVICES_FOUND)
-                    : NOTIFY_DISPLAY(NO_ACTIVE_DEVICES);
+    END_REQUEST(lane);
+    if (aborted == ABORT_CANCELLED) /* nobody waits for it */
+        return;
+    NOTIFY_DISPLAY_LIST(aborted == ABORT_DEADLINE ? DEVICES_TIMED_OUT : result, generation);
 }
 
-void http_set_device(const char* dev_id)
+void http_set_device(const char* dev_id, int id_len)
 {
-    ACQUIRE_LOCK(client_lock);
-    int str_len = sprintf(sprintf_buf, "{\"device_ids\":[\"%s\"],\"play\":true}", dev_id); // TODO: true if now playing, else false
-    assert((str_len <= SPRINTF_BUF_SIZE) && "Device id too long");
-    validate_token();
-    s_state.handler_cb = default_http_event_handler;
-    s_state.method = HTTP_METHOD_PUT;
-    s_state.endpoint = PLAYERURL(PLAYER);
-    esp_http_client_set_post_field(s_state.client, sprintf_buf, str_len);
+    Client_state_t* lane = &s_control;
 
-    PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
+    if (ESP_OK != BEGIN_REQUEST(lane, COMMAND_BUDGET, RATE_COMMAND, 0)) {
+        NOTIFY_DISPLAY(PLAYBACK_TRANSFERRED_FAIL);
+        return;
+    }
+    int str_len = snprintf(lane->req.post, lane->req.post_size,
+        "{\"device_ids\":[\"%.*s\"],\"play\":true}", id_len, dev_id); // TODO: true if now playing, else false
+    assert((str_len < lane->req.post_size) && "Device id too long");
+    validate_token(lane);
+    lane->handler_cb = default_http_event_handler;
+    lane->method = HTTP_METHOD_PUT;
+    lane->endpoint = PLAYERURL(PLAYER);
+    esp_http_client_set_post_field(lane->client, lane->req.post, str_len);
+    atomic_store(&s_full_refresh, true); /* the device changes */
+
+    PREPARE_CLIENT(lane, "application/json");
 retry:
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
-    esp_http_client_set_post_field(s_state.client, NULL, 0); /* Clear post field */
-    if (s_state.err == ESP_OK) {
-        s_retries = 0;
-        if (PLAYBACK_TRANSFERED(s_state)) {
-            ESP_LOGI(TAG, "Playback transfered to: %s", dev_id);
+    perform(lane);
+    esp_http_client_set_post_field(lane->client, NULL, 0); /* Clear post field */
+    if (lane->err == ESP_OK) {
+        lane->retries = 0;
+        if (PLAYBACK_TRANSFERED(lane)) {
+            ESP_LOGI(TAG, "Playback transfered to: %.*s", id_len, dev_id);
             NOTIFY_DISPLAY(PLAYBACK_TRANSFERRED_OK);
         } else {
             NOTIFY_DISPLAY(PLAYBACK_TRANSFERRED_FAIL);
         }
-    } else {
-        handle_err_connection();
+    } else if (handle_err_connection(lane)) {
         goto retry;
     }
-    RELEASE_LOCK(client_lock);
+    END_REQUEST(lane);
 }
 
 void http_update_volume(int8_t volume_percent)
 {
-    ACQUIRE_LOCK(client_lock);
-    validate_token();
-    sprintf(sprintf_buf, "%s%d", PLAYERURL(VOLUME), volume_percent);
+    Client_state_t* lane = &s_control;
+
+    if (ESP_OK != BEGIN_REQUEST(lane, COMMAND_BUDGET, RATE_COMMAND, 0))
+        return;
+    validate_token(lane);
+    snprintf(lane->req.post, lane->req.post_size, "%s%d", PLAYERURL(VOLUME), volume_percent);
 
-    s_state.handler_cb = default_http_event_handler;
-    s_state.method = HTTP_METHOD_PUT;
-    s_state.endpoint = sprintf_buf;
+    lane->handler_cb = default_http_event_handler;
+    lane->method = HTTP_METHOD_PUT;
+    lane->endpoint = lane->req.post;
 
-    PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
+    PREPARE_CLIENT(lane, "application/json");
+    perform(lane);
 
-    if (s_state.err != ESP_OK || s_state.status_code != 204) {
+    if (lane->err != ESP_OK || lane->status_code != 204) {
         ESP_LOGE(TAG, "HTTP PUT request failed: %s, status code: %d",
-            esp_err_to_name(s_state.err), s_state.status_code);
-        ESP_LOGE(TAG, "The answer was:\n%s", http_buffer);
+            esp_err_to_name(lane->err), lane->status_code);
+        ESP_LOGE(TAG, "The answer was:\n%s", lane->req.buffer);
     } else {
         ESP_LOGW(TAG, "vol: %d", volume_percent);
-        itoa(volume_percent, TRACK->device.volume_percent, 10);
+        track_write_begin();
+        itoa(volume_percent, s_track->device.volume_percent, 10);
+        track_write_end();
     }
-    RELEASE_LOCK(client_lock);
+    END_REQUEST(lane);
 }
 
-void http_play_context_uri(const char* uri)
+/**
+ * @brief Ask for the volume to be set without waiting for the request. The
+ * player task sends it, and only the latest level if several are asked
+ * meanwhile. The display is notified with TRACK_CHANGED_VOLUME once it's
+ * done.
+ *
+ */
+void http_update_volume_async(uint8_t volume_percent)
 {
-    ACQUIRE_LOCK(client_lock);
-    int str_len = sprintf(sprintf_buf, "{\"context_uri\":\"%s\"}", uri);
-    assert((str_len <= SPRINTF_BUF_SIZE) && "uri too long");
-    validate_token();
-    s_state.handler_cb = default_http_event_handler;
-    s_state.method = HTTP_METHOD_PUT;
-    s_state.endpoint = PLAYERURL(PLAY);
+    atomic_store(&s_volume_request, volume_percent);
+    UNBLOCK_PLAYER_TASK;
+}
+
+/**
+ * @brief True while a level given to http_update_volume_async() wasn't
+ * sent yet or its request is in flight.
+ *
+ */
+bool http_volume_pending()
+{
+    return atomic_load(&s_volume_request) >= 0;
+}
+
+/**
+ * @brief Fetch the list on the background lane, by the player task. The
+ * display is notified as with http_user_playlists() (or
+ * http_available_devices()), or with PLAYLISTS_TIMED_OUT (or
+ * DEVICES_TIMED_OUT). A cancelled fetch sends nothing. The answer carries
+ * generation, so the display can tell it from the answer to an older fetch.
+ *
+ */
+void http_user_playlists_async(uint32_t generation)
+{
+    atomic_store(&s_playlists_generation, generation);
+    atomic_fetch_or(&s_list_requests, LIST_PLAYLISTS);
+    UNBLOCK_PLAYER_TASK;
+}
+
+void http_available_devices_async(uint32_t generation)
+{
+    atomic_store(&s_devices_generation, generation);
+    atomic_fetch_or(&s_list_requests, LIST_DEVICES);
+    UNBLOCK_PLAYER_TASK;
+}
 
-    esp_http_client_set_post_field(s_state.client, sprintf_buf, str_len);
-    PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
-    esp_http_client_set_post_field(s_state.client, NULL, 0);
-    RELEASE_LOCK(client_lock);
+/**
+ * @brief The user left the page that needed the background request: abort
+ * it, or its retries, and drop the lists not fetched yet. The lane is free
+ * as soon as the transfer stops, the connection is closed.
+ *
+ */
+void http_cancel_background()
+{
+    ACQUIRE_LOCK(s_list_lock);
+    atomic_store(&s_list_requests, 0);
+    xEventGroupSetBits(s_lane_events, BACKGROUND_CANCEL_BIT);
+    RELEASE_LOCK(s_list_lock);
+}
+
+void http_play_context_uri(const char* uri, int uri_len)
+{
+    Client_state_t* lane = &s_control;
+
+    if (ESP_OK != BEGIN_REQUEST(lane, COMMAND_BUDGET, RATE_COMMAND, 0)) {
+        send_err("Out of memory");
+        return;
+    }
+    int str_len = snprintf(lane->req.post, lane->req.post_size,
+        "{\"context_uri\":\"%.*s\"}", uri_len, uri);
+    assert((str_len < lane->req.post_size) && "uri too long");
+    validate_token(lane);
+    lane->handler_cb = default_http_event_handler;
+    lane->method = HTTP_METHOD_PUT;
+    lane->endpoint = PLAYERURL(PLAY);
+
+    esp_http_client_set_post_field(lane->client, lane->req.post, str_len);
+    PREPARE_CLIENT(lane, "application/json");
+    perform(lane);
+    esp_http_client_set_post_field(lane->client, NULL, 0);
+    END_REQUEST(lane);
 }
 
 /* Private functions ---------------------------------------------------------*/
 
-static esp_err_t validate_token()
+/**
+ * @brief Take the lane for a request. A control request clears
+ * CONTROL_IDLE_BIT, so the background lane holds its next transfer.
+ *
+ */
+static void lane_acquire(Client_state_t* lane, rate_class_t cls, uint32_t deadline_ms)
+{
+    ACQUIRE_LOCK(lane->lock);
+    if (lane == &s_control)
+        xEventGroupClearBits(s_lane_events, CONTROL_IDLE_BIT);
+    lane->started = xTaskGetTickCount();
+    lane->deadline_ms = deadline_ms;
+    lane->rate_class = cls;
+    lane->aborted = ABORT_NONE;
+}
+
+/**
+ * @brief lane_acquire() and take the request memory.
+ *
+ * @retval ESP_ERR_NO_MEM with the lane released, if the block can't be taken
+ */
+static esp_err_t lane_begin(Client_state_t* lane, request_budget_t* budget, rate_class_t cls, uint32_t deadline_ms)
+{
+    lane_acquire(lane, cls, deadline_ms);
+    esp_err_t err = request_arena_begin(&lane->req, budget);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s lane: no memory for the request", lane->name);
+        lane_release(lane);
+    }
+    return err;
+}
+
+static void lane_release(Client_state_t* lane)
+{
+    if (lane == &s_control)
+        xEventGroupSetBits(s_lane_events, CONTROL_IDLE_BIT);
+    RELEASE_LOCK(lane->lock);
+}
+
+/**
+ * @brief Send the request prepared on the lane. Control requests go first:
+ * a background transfer doesn't start while one is in flight, and the
+ * control lane never waits for the background one. Every request takes a
+ * token of the rate limiter first, a 429 empties the bucket.
+ *
+ */
+static esp_err_t perform(Client_state_t* lane)
+{
+    if (lane != &s_control)
+        xEventGroupWaitBits(s_lane_events, CONTROL_IDLE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    if (!lane->aborted)
+        lane->aborted = request_obsolete(lane);
+    if (!lane->aborted)
+        lane->aborted = take_token(lane, lane->rate_class);
+    if (!lane->aborted) {
+        lane->retry_after_ms = 0;
+        lane->err = esp_http_client_perform(lane->client);
+        lane->status_code = esp_http_client_get_status_code(lane->client);
+        if (lane->status_code == 429) {
+            uint32_t ms = lane->retry_after_ms ? lane->retry_after_ms : RETRY_AFTER_DEFAULT_MS;
+            ESP_LOGW(TAG, "Rate limited by the server (%s lane), backing off %u ms", lane->name, ms);
+            rate_limit_backoff(ms);
+        }
+    }
+    if (lane->aborted) { /* whatever arrived is incomplete */
+        lane->err = ESP_FAIL;
+        lane->status_code = 0;
+    }
+    return lane->err;
+}
+
+static abort_t request_obsolete(Client_state_t* lane)
+{
+    if (lane->cancel_bit && (xEventGroupGetBits(s_lane_events) & lane->cancel_bit))
+        return ABORT_CANCELLED;
+    if (lane->deadline_ms && pdTICKS_TO_MS(xTaskGetTickCount() - lane->started) >= lane->deadline_ms)
+        return ABORT_DEADLINE;
+    return ABORT_NONE;
+}
+
+/**
+ * @brief Wait for a token of the rate limiter. The wait of an abortable lane
+ * ends with a cancel, or past its deadline. The control lane runs on the
+ * display task: during a backoff it fails at once, with a toast.
+ *
+ * @retval ABORT_NONE once the token is taken
+ */
+static abort_t take_token(Client_state_t* lane, rate_class_t cls)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait;
+    abort_t    aborted = ABORT_NONE;
+
+    if (!lane->cancel_bit && rate_limit_in_backoff()) {
+        ESP_LOGW(TAG, "%s lane: backing off, request dropped", lane->name);
+        send_err("Too many requests, try later");
+        return ABORT_BACKOFF;
+    }
+    while (!rate_limit_take(cls, &wait)) {
+        if (lane->cancel_bit) {
+            xEventGroupWaitBits(s_lane_events, lane->cancel_bit, pdFALSE, pdFALSE, wait);
+        } else {
+            vTaskDelay(wait);
+        }
+        if ((aborted = request_obsolete(lane)))
+            break;
+    }
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited) {
+        ESP_LOGD(TAG, "%s lane throttled %u ms", lane->name, pdTICKS_TO_MS(waited));
+        rate_limit_waited(cls, waited);
+    }
+    return aborted;
+}
+
+static esp_err_t validate_token(Client_state_t* lane)
 {
-    /* client_lock lock already must be aquired */
+    /* the lane lock already must be aquired. The token is shared, the
+     * lane that finds it expired refreshes it for both */
+    ACQUIRE_LOCK(s_token_lock);
+    bool valid = (s_tokens.expiresIn - 10) > time(0);
+    RELEASE_LOCK(s_token_lock);
+    if (valid)
+        return ESP_OK;
 
-    if ((s_state.tokens.expiresIn - 10) > time(0))
+    /* not perform(): the control lane may be waiting for s_token_lock. The
+     * rate limiter is waited for before taking it, for the same reason */
+    if ((lane->aborted = take_token(lane, RATE_COMMAND)))
+        return ESP_FAIL;
+    ACQUIRE_LOCK(s_token_lock);
+    if ((s_tokens.expiresIn - 10) > time(0)) { /* the other lane got one meanwhile */
+        RELEASE_LOCK(s_token_lock);
         return ESP_OK;
+    }
 
     ESP_LOGD(TAG, "Access Token expired or expiring soon. Fetching a new one.");
-    s_state.handler_cb = default_http_event_handler;
-    s_state.method = HTTP_METHOD_POST;
-    s_state.endpoint = TOKEN_URL;
-    PREPARE_CLIENT(s_state, "Basic " AUTH_TOKEN, "application/x-www-form-urlencoded");
+    lane->handler_cb = default_http_event_handler;
+    lane->method = HTTP_METHOD_POST;
+    lane->endpoint = TOKEN_URL;
+    esp_http_client_set_url(lane->client, lane->endpoint);
+    esp_http_client_set_method(lane->client, lane->method);
+    esp_http_client_set_header(lane->client, "Authorization", "Basic " AUTH_TOKEN);
+    esp_http_client_set_header(lane->client, "Content-Type", "application/x-www-form-urlencoded");
 
     const char* post_data = "grant_type=refresh_token&refresh_token=" REFRESH_TOKEN;
-    esp_http_client_set_post_field(s_state.client, post_data, strlen(post_data));
-    s_state.err = esp_http_client_perform(s_state.client);
-    s_state.status_code = esp_http_client_get_status_code(s_state.client);
-    esp_http_client_set_post_field(s_state.client, NULL, 0); /* Clear post field */
-
-    if (s_state.err != ESP_OK || s_state.status_code != 200) {
+    esp_http_client_set_post_field(lane->client, post_data, strlen(post_data));
+    lane->refreshing_token = true;
+    lane->err = esp_http_client_perform(lane->client);
+    lane->status_code = esp_http_client_get_status_code(lane->client);
+    lane->refreshing_token = false;
+    esp_http_client_set_post_field(lane->client, NULL, 0); /* Clear post field */
+
+    if (lane->err != ESP_OK || lane->status_code != 200) {
         ESP_LOGE(TAG, "HTTP POST request failed: %s, status code: %d",
-            esp_err_to_name(s_state.err), s_state.status_code);
-        ESP_LOGE(TAG, "The answer was:\n%s", http_buffer);
+            esp_err_to_name(lane->err), lane->status_code);
+        ESP_LOGE(TAG, "The answer was:\n%s", lane->req.buffer);
+        RELEASE_LOCK(s_token_lock);
         return ESP_FAIL;
     }
 
-    parseTokens(http_buffer, &s_state.tokens);
+    parseTokens(&lane->req, &s_tokens);
 
-    ESP_LOGW(TAG, "Access Token obtained:\n%s", &s_state.tokens.access_token[7]);
+    ESP_LOGW(TAG, "Access Token obtained (%s lane):\n%s", lane->name, &s_tokens.access_token[7]);
+    RELEASE_LOCK(s_token_lock);
     return ESP_OK;
 }
 
-static inline void handle_track_fetched(TrackInfo** new_track)
+/**
+ * @brief The server rejected the token before it expired: get a new one.
+ * The request prepared on the lane is kept.
+ *
+ */
+static esp_err_t refresh_token(Client_state_t* lane)
+{
+    handler_cb_t             handler_cb = lane->handler_cb;
+    esp_http_client_method_t method = lane->method;
+    const char*              endpoint = lane->endpoint;
+
+    ACQUIRE_LOCK(s_token_lock);
+    s_tokens.expiresIn = 0;
+    RELEASE_LOCK(s_token_lock);
+    esp_err_t err = validate_token(lane);
+
+    lane->handler_cb = handler_cb;
+    lane->method = method;
+    lane->endpoint = endpoint;
+    return err;
+}
+
+/**
+ * @brief The header is copied by the client, the token lock is held only
+ * for the copy.
+ *
+ */
+static void set_auth_header(Client_state_t* lane)
 {
-    parseTrackInfo(http_buffer, *new_track);
+    ACQUIRE_LOCK(s_token_lock);
+    esp_http_client_set_header(lane->client, "Authorization", s_tokens.access_token);
+    RELEASE_LOCK(s_token_lock);
+}
 
-    SWAP_PTRS(*new_track, TRACK);
+/**
+ * @brief Publish the player state just received.
+ *
+ * @retval false if it was a light poll and the item changed, the full
+ * player state must be fetched
+ */
+static inline bool handle_track_fetched(TrackInfo** new_track)
+{
+    Client_state_t* lane = &s_background;
+    player_digest_t digest;
 
-    if (strcmp(TRACK->device.volume_percent, (*new_track)->device.volume_percent)) {
-        NOTIFY_DISPLAY(VOLUME_CHANGED);
+    player_handler_digest(&digest);
+
+    if (LIGHT_POLL(lane)) {
+        if (!digest.item_hash || strcmp(digest.item_uri, s_track->uri)) {
+            return false;
+        }
+        notify_track(update_playback(digest.progress_ms, digest.is_playing));
+        return true;
     }
-    if (0 == strcmp(TRACK->name, (*new_track)->name)) {
-        free_track(*new_track);
-        NOTIFY_DISPLAY(SAME_TRACK);
-    } else {
-        free_track(*new_track);
+    s_light_polls = 0;
+
+    if (digest.item_hash && digest.item_hash == s_digest.item_hash
+        && digest.device_hash == s_digest.device_hash) {
+        /* Same item on the same device: only the playback position
+         * could have changed, skip parsing the document */
+        notify_track(update_playback(digest.progress_ms, digest.is_playing));
+        return true;
+    }
+    s_digest = digest;
+
+    parseTrackInfo(&lane->req, *new_track);
+
+    track_write_begin();
+    SWAP_PTRS(*new_track, s_track);
+    track_write_end();
+
+    /* the previous snapshot is kept untouched until the next poll
+     * rewinds its arena, so there is nothing to free here */
+    uint16_t changes = track_info_diff(*new_track, s_track) | TRACK_CHANGED_PROGRESS;
+    if (!(changes & TRACK_CHANGED_ITEM) && seeked(*new_track, s_track->progress_ms))
+        changes |= TRACK_CHANGED_SEEK;
+    s_progress_tick = xTaskGetTickCount();
+
+    if (changes & TRACK_CHANGED_ITEM) {
         ESP_LOGI(TAG, "New track");
-        ESP_LOGI(TAG, "Title: %s", TRACK->name);
-        StrListItem* artist = TRACK->artists.first;
-        while (artist) {
-            ESP_LOGI(TAG, "Artist: %s", artist->str);
-            artist = artist->next;
+        ESP_LOGI(TAG, "Title: %s", s_track->name);
+        for (uint16_t i = 0; i < s_track->artists.count; i++) {
+            uint16_t    len;
+            const char* artist = strTableGet(&s_track->artists, i, &len);
+            ESP_LOGI(TAG, "Artist: %.*s", len, artist);
+        }
+        ESP_LOGI(TAG, "Album: %s", s_track->album);
+    }
+    notify_track(changes);
+    return true;
+}
+
+/**
+ * @brief Same item, only the playback position was received.
+ *
+ * @return track_change_t bits
+ */
+static uint16_t update_playback(time_t progress_ms, bool is_playing)
+{
+    uint16_t changes = TRACK_CHANGED_PROGRESS;
+
+    if (s_track->isPlaying != is_playing)
+        changes |= TRACK_CHANGED_PLAY_STATE;
+    if (seeked(s_track, progress_ms))
+        changes |= TRACK_CHANGED_SEEK;
+
+    track_write_begin();
+    s_track->progress_ms = progress_ms;
+    s_track->isPlaying = is_playing;
+    track_write_end();
+    s_progress_tick = xTaskGetTickCount();
+    return changes;
+}
+
+/**
+ * @brief True if progress_ms isn't where the previous snapshot would be by
+ * now, so the position was moved rather than just played.
+ *
+ */
+static bool seeked(const TrackInfo* prev, time_t progress_ms)
+{
+    time_t expected = prev->progress_ms;
+
+    if (prev->isPlaying)
+        expected += pdTICKS_TO_MS(xTaskGetTickCount() - s_progress_tick);
+    return llabs((long long)(progress_ms - expected)) > SEEK_TOLERANCE_MS;
+}
+
+/**
+ * @brief Writes to the published snapshot go between track_write_begin()
+ * and track_write_end(), keep them to a few stores. Only the player task
+ * rewrites the snapshot that isn't published, outside of them.
+ *
+ */
+static void track_write_begin()
+{
+    portENTER_CRITICAL(&s_track_mux);
+    atomic_fetch_add_explicit(&s_track_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void track_write_end()
+{
+    atomic_fetch_add_explicit(&s_track_seq, 1, memory_order_release);
+    portEXIT_CRITICAL(&s_track_mux);
+}
+
+static void notify_track(uint16_t changes)
+{
+    display_event_t event = {
+        .type = TRACK_UPDATED,
+        .track = {
+            .changes = changes,
+            .progress_ms = s_track->progress_ms,
+            .is_playing = s_track->isPlaying,
+            .duration_ms = s_track->duration_ms,
+            .volume_percent = atoi(s_track->device.volume_percent),
+        },
+    };
+    display_post(&event);
+}
+
+static void account_poll()
+{
+    Client_state_t* lane = &s_background;
+
+    if (s_poll_stats.since == 0)
+        s_poll_stats.since = xTaskGetTickCount();
+
+    if (LIGHT_POLL(lane)) {
+        s_poll_stats.light_polls++;
+        s_poll_stats.light_bytes += lane->req.body_len;
+    } else {
+        s_poll_stats.full_polls++;
+        s_poll_stats.full_bytes += lane->req.body_len;
+    }
+}
+
+static void send_volume_request()
+{
+    int percent = atomic_load(&s_volume_request);
+
+    while (percent >= 0) {
+        http_update_volume(percent);
+        /* cleared only if no other level was asked during the request,
+         * otherwise percent gets the new one and it's sent too */
+        if (atomic_compare_exchange_strong(&s_volume_request, &percent, -1)) {
+            notify_track(TRACK_CHANGED_VOLUME);
+            break;
         }
-        ESP_LOGI(TAG, "Album: %s", TRACK->album);
-        NOTIFY_DISPLAY(NEW_TRACK);
     }
 }
 
-static inline void handle_err_connection()
+/**
+ * @brief Fetch the lists asked for. A cancel asked before they were taken
+ * was for older requests: it is cleared in the same step, under s_list_lock,
+ * so a cancel asked after is never lost.
+ *
+ */
+static void send_list_requests()
 {
+    ACQUIRE_LOCK(s_list_lock);
+    unsigned lists = atomic_exchange(&s_list_requests, 0);
+    xEventGroupClearBits(s_lane_events, BACKGROUND_CANCEL_BIT);
+    RELEASE_LOCK(s_list_lock);
+
+    if (lists & LIST_PLAYLISTS)
+        http_user_playlists(atomic_load(&s_playlists_generation));
+    if (lists & LIST_DEVICES)
+        http_available_devices(atomic_load(&s_devices_generation));
+}
+
+/**
+ * @brief Wait before retrying a request that failed to connect.
+ *
+ * @retval false if the request was aborted meanwhile, don't retry
+ */
+static inline bool handle_err_connection(Client_state_t* lane)
+{
+    if (lane->aborted) {
+        ESP_LOGW(TAG, "%s request aborted (%s)", lane->name, ABORT_LOOKUP[lane->aborted]);
+        lane->retries = 0; /* not the connection's fault */
+        return false;
+    }
     ESP_LOGE(TAG, "HTTP %s request failed: %s",
-        HTTP_METHOD_LOOKUP[s_state.method],
-        esp_err_to_name(s_state.err));
-    assert((++s_retries <= RETRIES_ERR_CONN) && "Restarting...");
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    ESP_LOGW(TAG, "Retrying %d/%d...", s_retries, RETRIES_ERR_CONN);
+        HTTP_METHOD_LOOKUP[lane->method],
+        esp_err_to_name(lane->err));
+    assert((++lane->retries <= RETRIES_ERR_CONN) && "Restarting...");
+    if (lane->cancel_bit) { /* a cancel ends the wait */
+        xEventGroupWaitBits(s_lane_events, lane->cancel_bit, pdFALSE, pdFALSE, pdMS_TO_TICKS(1000));
+    } else {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+    if ((lane->aborted = request_obsolete(lane))) {
+        lane->retries = 0;
+        return false;
+    }
+    ESP_LOGW(TAG, "Retrying %d/%d on the %s lane...", lane->retries, RETRIES_ERR_CONN, lane->name);
     debug_mem();
+    return true;
 }
 
 static esp_err_t _http_event_handler(esp_http_client_event_t* evt)
 {
-    s_state.handler_cb(http_buffer, evt);
+    Client_state_t* lane = evt->user_data;
+
+    if (lane->aborted)
+        return ESP_OK; /* the rest of the response is dropped */
+    if (!lane->refreshing_token && (lane->aborted = request_obsolete(lane))) {
+        /* close the connection now instead of draining a response nobody
+         * waits for, the next request opens a new one */
+        esp_http_client_cancel_request(evt->client);
+        return ESP_OK;
+    }
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && !strcasecmp(evt->header_key, "Retry-After")) {
+        lane->retry_after_ms = atoi(evt->header_value) * 1000; /* seconds */
+    }
+    lane->handler_cb(&lane->req, evt);
     return ESP_OK;
 }
 
 static void player_task(void* pvParameters)
 {
-    TrackInfo* new_track = &(TrackInfo) { 0 };
-    CALLOC(new_track->name, 1);
+    Client_state_t* lane = &s_background;
+    TrackInfo*      new_track = &s_tracks[1];
 
     while (1) {
         bool     first_try = true;
+        bool     state_awaited; /* the display waits for the first poll */
         uint32_t notif;
 
         xTaskNotifyWait(
@@ -402,73 +1019,130 @@ static void player_task(void* pvParameters)
             &notif, /* Stores the notified value */
             portMAX_DELAY); /* xTicksToWait */
 
-        if (notif == ENABLE_TASK)
-            do {
-                ACQUIRE_LOCK(client_lock);
-                validate_token();
-                s_state.handler_cb = default_http_event_handler;
-                s_state.method = HTTP_METHOD_GET;
-                s_state.endpoint = PLAYERURL(PLAYING);
-
-            prepare:
-                PREPARE_CLIENT(s_state, s_state.tokens.access_token, "application/json");
-
-            retry:
-                s_state.err = esp_http_client_perform(s_state.client);
-
-                s_state.status_code = esp_http_client_get_status_code(s_state.client);
-                esp_http_client_set_post_field(s_state.client, NULL, 0); /* Clear post field */
-                if (s_state.err == ESP_OK) {
-                    s_retries = 0;
-                    ESP_LOGD(TAG, "Received:\n%s", http_buffer);
-                    if (s_state.status_code == 200) {
-                        handle_track_fetched(&new_track);
+        send_volume_request();
+        send_list_requests();
+        if (notif != ENABLE_TASK)
+            continue;
+
+        lane->keep_block = true; /* polling: keep the request block */
+        atomic_store(&s_full_refresh, true);
+        state_awaited = true;
+        do {
+            bool published = false; /* the display got the state, or why there is none */
+            bool refresh_taken = false; /* s_full_refresh was cleared for this poll */
+
+            send_volume_request();
+            send_list_requests();
+            bool token_refreshed = false;
+            if (ESP_OK != BEGIN_REQUEST(lane, PLAYER_BUDGET, RATE_POLL, POLL_DEADLINE_MS))
+                goto wait; /* skip this cycle */
+            validate_token(lane);
+            lane->handler_cb = player_handler;
+            lane->method = HTTP_METHOD_GET;
+            s_poll_stats.cycles++;
+            /* cleared before the request, so a refresh asked meanwhile
+             * is kept for the next poll */
+            refresh_taken = atomic_exchange(&s_full_refresh, false);
+            if (refresh_taken || s_light_polls >= FULL_REFRESH_CYCLES) {
+                lane->endpoint = PLAYERURL(PLAYING);
+            } else {
+                lane->endpoint = PLAYERURL(CURRENTLY_PLAYING);
+                s_light_polls++;
+            }
+
+        prepare:
+            PREPARE_CLIENT(lane, "application/json");
+
+        retry:
+            perform(lane);
+            esp_http_client_set_post_field(lane->client, NULL, 0); /* Clear post field */
+            if (lane->err == ESP_OK) {
+                lane->retries = 0;
+                ESP_LOGD(TAG, "Received:\n%s", lane->req.buffer);
+                if (lane->status_code == 200) {
+                    account_poll();
+                    if (handle_track_fetched(&new_track)) {
+                        published = true;
+                        if (!LIGHT_POLL(lane))
+                            refresh_taken = false; /* done */
                         goto exit;
                     }
-                    if (s_state.status_code == 401) { /* bad token or expired */
-                        ESP_LOGW(TAG, "Token expired, getting a new one");
+                    ESP_LOGD(TAG, "Item changed, fetching the full player state");
+                    lane->endpoint = PLAYERURL(PLAYING);
+                    goto prepare;
+                }
+                if (lane->status_code == 401 && !token_refreshed) { /* bad token or expired */
+                    ESP_LOGW(TAG, "Token rejected, getting a new one");
+                    token_refreshed = true;
+                    refresh_token(lane);
+                    goto prepare;
+                }
+                if (LIGHT_POLL(lane) && lane->status_code == 204) {
+                    /* nothing playing: no change, the light polls go on.
+                     * A stop is seen by the next periodic full refresh */
+                    goto exit;
+                }
+                if (DEVICE_INACTIVE(lane)) { /* Playback not available or active */
+                    ESP_LOGW(TAG, "Device inactive");
+                    if (first_try && s_track->device.id) {
+                        first_try = false;
+                        int str_len = snprintf(lane->req.post, lane->req.post_size,
+                            "{\"device_ids\":[\"%s\"],\"play\":false}", s_track->device.id);
+                        assert((str_len < lane->req.post_size) && "device id too long");
+                        validate_token(lane);
+                        lane->handler_cb = default_http_event_handler;
+                        lane->method = HTTP_METHOD_PUT;
+                        lane->endpoint = PLAYERURL(PLAYER);
+                        esp_http_client_set_post_field(lane->client, lane->req.post, str_len);
                         goto prepare;
-                    }
-                    if (DEVICE_INACTIVE(s_state)) { /* Playback not available or active */
-                        ESP_LOGW(TAG, "Device inactive");
-                        if (first_try && TRACK->device.id) {
-                            first_try = false;
-                            int str_len = sprintf(sprintf_buf, "{\"device_ids\":[\"%s\"],\"play\":false}", TRACK->device.id);
-                            assert((str_len <= SPRINTF_BUF_SIZE) && "device id too long");
-                            validate_token();
-                            s_state.handler_cb = default_http_event_handler;
-                            s_state.method = HTTP_METHOD_PUT;
-                            s_state.endpoint = PLAYERURL(PLAYER);
-                            esp_http_client_set_post_field(s_state.client, sprintf_buf, str_len);
-                            goto prepare;
-                        } else {
-                            ESP_LOGW(TAG, "Failed to reconnect with the device");
-                            first_try = true;
-                            NOTIFY_DISPLAY(LAST_DEVICE_FAILED);
-                            goto exit;
-                        }
-                    }
-                    if (PLAYBACK_TRANSFERED(s_state)) {
-                        ESP_LOGI(TAG, "Reconnected with device: %s", TRACK->device.id);
+                    } else {
+                        ESP_LOGW(TAG, "Failed to reconnect with the device");
                         first_try = true;
+                        NOTIFY_DISPLAY(LAST_DEVICE_FAILED);
+                        published = true;
                         goto exit;
                     }
-                    /* Unhandled status_code follows */
-                    ESP_LOGE(TAG, "ENDPOINT: %s, METHOD: %s, STATUS_CODE: %d", s_state.endpoint,
-                        HTTP_METHOD_LOOKUP[s_state.method], s_state.status_code);
-                    if (*http_buffer) {
-                        ESP_LOGE(TAG, "%s", http_buffer);
+                }
+                if (PLAYBACK_TRANSFERED(lane)) {
+                    ESP_LOGI(TAG, "Reconnected with device: %s", s_track->device.id);
+                    first_try = true;
+                    if (state_awaited) { /* poll again now, not in MS_NOTIF_POLLING */
+                        lane->handler_cb = player_handler;
+                        lane->method = HTTP_METHOD_GET;
+                        lane->endpoint = PLAYERURL(PLAYING);
+                        goto prepare;
                     }
                     goto exit;
-                } else {
-                    handle_err_connection();
-                    goto retry;
                 }
-            exit:
-                RELEASE_LOCK(client_lock);
-                debug_mem();
-                xTaskNotifyWait(pdFALSE, ULONG_MAX, &notif, pdMS_TO_TICKS(MS_NOTIF_POLLING));
-            } while (notif != DISABLE_TASK);
+                /* Unhandled status_code follows */
+                ESP_LOGE(TAG, "ENDPOINT: %s, METHOD: %s, STATUS_CODE: %d", lane->endpoint,
+                    HTTP_METHOD_LOOKUP[lane->method], lane->status_code);
+                if (*lane->req.buffer) {
+                    ESP_LOGE(TAG, "%s", lane->req.buffer);
+                }
+                goto exit;
+            } else if (handle_err_connection(lane)) {
+                goto retry;
+            }
+        exit:
+            END_REQUEST(lane);
+            debug_mem();
+        wait:
+            if (refresh_taken) /* the full poll failed, the next one is full */
+                atomic_store(&s_full_refresh, true);
+            if (state_awaited && !published) { /* skipped, aborted or unhandled */
+                ESP_LOGW(TAG, "First poll failed");
+                NOTIFY_DISPLAY(PLAYER_STATE_FAILED);
+            }
+            state_awaited = false;
+            xTaskNotifyWait(pdFALSE, ULONG_MAX, &notif, pdMS_TO_TICKS(MS_NOTIF_POLLING));
+        } while (notif != DISABLE_TASK);
+
+        /* Not polling anymore, give the request block back to the heap */
+        ACQUIRE_LOCK(lane->lock);
+        lane->keep_block = false;
+        request_arena_end(&lane->req, false);
+        RELEASE_LOCK(lane->lock);
     }
     assert(false && "Unexpected exit of infinite task loop");
 }
@@ -484,17 +1158,26 @@ static inline void debug_mem()
     ESP_LOGI(TAG, "[NOW_PLAYING]: stack high water mark: %d", uxTaskGetStackHighWaterMark(NULL));
     ESP_LOGI(TAG, "[NOW_PLAYING]: minimum free heap size: %d", esp_get_minimum_free_heap_size());
     ESP_LOGI(TAG, "[NOW_PLAYING]: free heap size: %d", esp_get_free_heap_size());
-}
-
-static inline void free_track(TrackInfo* track)
-{
-    free(track->name);
-    free(track->album);
-
-    strListClear(&track->artists);
+    request_arena_log(&s_background.req, BUDGETS, sizeof(BUDGETS) / sizeof(BUDGETS[0]));
+
+    /* Bytes saved: what every cycle would have cost as a full poll, minus
+     * what was actually received (escalated light polls included) */
+    poll_stats_t* st = &s_poll_stats;
+    uint32_t      elapsed_ms = pdTICKS_TO_MS(xTaskGetTickCount() - st->since);
+    if (st->full_polls && elapsed_ms) {
+        int64_t saved = (int64_t)st->cycles * (st->full_bytes / st->full_polls)
+            - (int64_t)(st->full_bytes + st->light_bytes);
+        ESP_LOGI(TAG, "[NOW_PLAYING]: polls: %u full, %u light, saved %lld bytes/hour",
+            st->full_polls, st->light_polls, saved * 3600000 / elapsed_ms);
+    }
 
-    free(track->device.id);
-    free(track->device.name);
-    free(track->device.type);
-    strcpy(track->device.volume_percent, "-1");
-}
\ No newline at end of file
+    rate_limit_stats_t rl;
+    rate_limit_stats(&rl);
+    ESP_LOGI(TAG, "[NOW_PLAYING]: rate limit: command %u/%u, poll %u/%u, list %u/%u throttled "
+                  "(%u, %u, %u ms waited), %u 429s",
+        rl.throttled[RATE_COMMAND], rl.granted[RATE_COMMAND],
+        rl.throttled[RATE_POLL], rl.granted[RATE_POLL],
+        rl.throttled[RATE_LIST], rl.granted[RATE_LIST],
+        rl.waited_ms[RATE_COMMAND], rl.waited_ms[RATE_POLL], rl.waited_ms[RATE_LIST],
+        rl.server_throttled);
+}
@@ -4,76 +4,142 @@
 #include <stdlib.h>
 #include <string.h>
 
-StrListItem* allocStrListItem(char* str)
+#define INITIAL_BUF_CAP     64
+#define INITIAL_OFFSETS_CAP 8
+
+static esp_err_t grow(StrTable* table, uint16_t needed_len)
 {
-    StrListItem* item = malloc(sizeof(*item));
-    if (item) {
-        item->str = str;
-        item->next = NULL;
+    if (table->count == table->offsets_cap) {
+        if (table->fixed)
+            return ESP_ERR_NO_MEM;
+        uint16_t  cap = table->offsets_cap ? table->offsets_cap * 2 : INITIAL_OFFSETS_CAP;
+        uint16_t* offsets = realloc(table->offsets, cap * sizeof(*offsets));
+        if (!offsets)
+            return ESP_ERR_NO_MEM;
+        table->offsets = offsets;
+        table->offsets_cap = cap;
+    }
+    if (needed_len >= table->buf_cap) { /* room for the null terminator */
+        if (table->fixed)
+            return ESP_ERR_NO_MEM;
+        uint32_t cap = table->buf_cap ? table->buf_cap : INITIAL_BUF_CAP;
+        while (cap <= needed_len)
+            cap *= 2;
+        if (cap > UINT16_MAX)
+            return ESP_ERR_NO_MEM;
+        char* buf = realloc(table->buf, cap);
+        if (!buf)
+            return ESP_ERR_NO_MEM;
+        table->buf = buf;
+        table->buf_cap = cap;
     }
-    return item;
+    return ESP_OK;
+}
+
+/**
+ * @brief Make the table use storage owned by the caller (e.g. an arena). The
+ * table never reallocs nor frees it, appends fail once it's full.
+ *
+ */
+void strTableInitFixed(StrTable* table, char* buf, uint16_t buf_size, uint16_t* offsets, uint16_t max_items)
+{
+    *table = (StrTable) {
+        .buf = buf,
+        .offsets = offsets,
+        .buf_cap = buf_size,
+        .offsets_cap = max_items,
+        .fixed = true,
+    };
+    buf[0] = '\0';
 }
 
-esp_err_t strListAppend(StrList* list, char* str)
+/**
+ * @brief Append len bytes of str as a new item. Amortized O(1): storage
+ * grows geometrically and the current length is tracked, never recomputed.
+ *
+ */
+esp_err_t strTableAppend(StrTable* table, const char* str, uint16_t len)
 {
-    StrListItem* item = allocStrListItem(str);
-    if (!item) {
+    uint16_t start = table->count ? table->len + 1 : 0; /* skip the '\n' separator */
+
+    if ((uint32_t)start + len > UINT16_MAX - 1)
         return ESP_ERR_NO_MEM;
-    }
-    if (!list->first) {
-        list->first = item;
-        list->last = item;
-        list->count = 1;
-    } else {
-        list->last->next = item;
-        list->last = item;
-        list->count++;
-    }
+
+    esp_err_t err = grow(table, start + len);
+    if (err != ESP_OK)
+        return err;
+
+    if (table->count)
+        table->buf[table->len] = '\n';
+    memcpy(table->buf + start, str, len);
+    table->buf[start + len] = '\0';
+
+    table->offsets[table->count++] = start;
+    table->len = start + len;
     return ESP_OK;
 }
 
-void strListClear(StrList* list)
+/**
+ * @brief O(1) access to an item. Items are not null terminated, the length
+ * is returned on len.
+ *
+ * @retval NULL if index is out of range
+ */
+const char* strTableGet(const StrTable* table, uint16_t index, uint16_t* len)
+{
+    if (index >= table->count)
+        return NULL;
+
+    uint16_t start = table->offsets[index];
+    uint16_t end = (index + 1 < table->count) ? table->offsets[index + 1] - 1 : table->len;
+    *len = end - start;
+    return table->buf + start;
+}
+
+/**
+ * @brief All the items separated by '\n'. It's the table storage itself,
+ * no copy is made.
+ *
+ */
+const char* strTableJoined(const StrTable* table)
 {
-    StrListItem* item = list->first;
-    StrListItem* aux;
-
-    while (item) {
-        free(item->str);
-        aux = item->next;
-        free(item);
-        item = aux;
+    return table->count ? table->buf : "";
+}
+
+void strTableClear(StrTable* table)
+{
+    if (table->fixed) {
+        table->count = table->len = 0;
+        table->buf[0] = '\0';
+        return;
     }
-    list->first = NULL;
-    list->last = NULL;
-    list->count = 0;
+    free(table->buf);
+    free(table->offsets);
+    *table = (StrTable) { 0 };
 }
 
-bool strListEqual(StrList* list1, StrList* list2)
+bool strTableEqual(const StrTable* table1, const StrTable* table2)
 {
-    if (list1->count != list2->count) {
+    if (table1->count != table2->count) {
         return false;
     }
-    StrListItem* item1 = list1->first;
-    StrListItem* item2 = list2->first;
-    while (item1 && item2) {
-        if (strcmp(item1->str, item2->str)) {
-            return false;
-        }
-        item1 = item1->next;
-        item2 = item2->next;
+    if (table1->count == 0) {
+        return true;
     }
-    return true;
+    return table1->len == table2->len
+        && !memcmp(table1->buf, table2->buf, table1->len);
 }
 
-int strListFindItem(StrList* list, char* str)
+int strTableFindItem(const StrTable* table, const char* str)
 {
-    StrListItem * item = list->first;
-    for (uint16_t i = 1; i <= list->count; i++)
-    {
-        if (strcmp(item->str, str) == 0) {
-            return i;
+    size_t str_len = strlen(str);
+
+    for (uint16_t i = 0; i < table->count; i++) {
+        uint16_t    len;
+        const char* item = strTableGet(table, i, &len);
+        if (len == str_len && !memcmp(item, str, len)) {
+            return i + 1;
         }
-        item = item->next;
     }
     return 0;
-}
\ No newline at end of file
+}
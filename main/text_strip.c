@@ -0,0 +1,115 @@
+/* Includes ------------------------------------------------------------------*/
+#include <assert.h>
+
+#include "text_strip.h"
+#include "unifont.h"
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t strip_display_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Set up a strip over buf, which must hold
+ * TEXT_STRIP_BUF_SIZE(max_width, tile_rows) bytes. The strip uses the same
+ * horizontal buffer layout as the ST7920, so windows are copied with shifts.
+ *
+ */
+void text_strip_init(text_strip_t* strip, uint8_t* buf, u8g2_uint_t max_width, uint8_t tile_rows)
+{
+    assert((max_width % 8 == 0) && (max_width / 8 <= UINT8_MAX) && "Invalid strip width");
+
+    strip->info = (u8x8_display_info_t) {
+        .tile_width = max_width / 8,
+        .tile_height = tile_rows,
+        .pixel_width = max_width,
+        .pixel_height = tile_rows * 8,
+    };
+    strip->width = 0;
+    /* no bus behind the strip, only memory */
+    u8x8_Setup(u8g2_GetU8x8(&strip->u8g2), strip_display_cb, u8x8_cad_empty,
+        u8x8_byte_empty, u8x8_dummy_cb);
+    u8g2_SetupBuffer(&strip->u8g2, buf, tile_rows, u8g2_ll_hvline_horizontal_right_lsb, U8G2_R0);
+}
+
+/**
+ * @brief Render str once into the strip. This is the only place where
+ * glyphs are decoded. Text out of Latin-1 is rendered with the Unicode font
+ * instead of font.
+ *
+ * @return false if str doesn't fit in the strip. It is then cut at the
+ * width of the strip
+ */
+bool text_strip_render(text_strip_t* strip, const uint8_t* font, const char* str)
+{
+    u8g2_t* u8g2 = &strip->u8g2;
+    bool    unicode = unifont_needed(str);
+
+    u8g2_ClearBuffer(u8g2);
+    u8g2_SetFont(u8g2, font);
+    strip->ascent = unicode ? unifont_ascent() : u8g2_GetAscent(u8g2);
+    strip->height = strip->ascent - (unicode ? unifont_descent() : u8g2_GetDescent(u8g2));
+    assert((strip->height <= strip->info.pixel_height) && "Font too tall for the strip");
+
+    strip->width = unicode ? unifont_width(str) : u8g2_GetUTF8Width(u8g2, str);
+    if (unicode) {
+        unifont_draw(u8g2, 0, strip->ascent, str);
+    } else {
+        u8g2_DrawUTF8(u8g2, 0, strip->ascent, str);
+    }
+    if (strip->width > strip->info.pixel_width) {
+        strip->width = strip->info.pixel_width;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief OR a display-wide window of the strip, starting at pixel column
+ * from, into the frame buffer of dst. The text baseline lands on the
+ * baseline row, and only rows top to bottom (excluded) are written. Each
+ * output word is built from two shifted source words.
+ *
+ */
+void text_strip_blit(text_strip_t* strip, u8g2_t* dst, u8g2_uint_t from, int baseline, int top, int bottom)
+{
+    const uint8_t  src_stride = strip->info.tile_width;
+    const uint8_t  dst_stride = u8g2_GetBufferTileWidth(dst);
+    const int      dst_rows = u8g2_GetBufferTileHeight(dst) * 8;
+    const int      end = bottom < dst_rows ? bottom : dst_rows;
+    const uint8_t  shift = from & 7;
+    const uint8_t* src_buf = u8g2_GetBufferPtr(&strip->u8g2) + (from >> 3);
+    uint8_t*       dst_buf = u8g2_GetBufferPtr(dst);
+
+    assert((dst_stride % 4 == 0) && ((from >> 3) + dst_stride <= src_stride) && "Window out of the strip");
+
+    int y = baseline - strip->ascent;
+    for (uint8_t row = 0; row < strip->height; row++, y++) {
+        if (y < top || y >= end)
+            continue;
+        const uint8_t* src = src_buf + row * src_stride;
+        uint8_t*       out = dst_buf + y * dst_stride;
+
+        for (uint8_t i = 0; i < dst_stride; i += 4, src += 4, out += 4) {
+            uint32_t word = (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16
+                | (uint32_t)src[2] << 8 | src[3];
+            if (shift)
+                word = word << shift | src[4] >> (8 - shift);
+            out[0] |= word >> 24;
+            out[1] |= word >> 16;
+            out[2] |= word >> 8;
+            out[3] |= word;
+        }
+    }
+}
+
+/* Private functions ---------------------------------------------------------*/
+static uint8_t strip_display_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr)
+{
+    if (msg == U8X8_MSG_DISPLAY_SETUP_MEMORY) {
+        /* u8x8 is the first member of the strip */
+        text_strip_t* strip = (text_strip_t*)u8x8;
+        u8x8_d_helper_display_setup_memory(u8x8, &strip->info);
+    }
+    return 1;
+}
@@ -0,0 +1,311 @@
+/**
+ * @file unifont.c
+ * @brief File layout (little endian):
+ *
+ *   header   unifont_header_t
+ *   index    count x unifont_entry_t, sorted by codepoint
+ *   bitmaps  16 rows per glyph, XBM bit order, 1 or 2 bytes per row
+ *
+ * Only one index block out of every INDEX_BLOCK entries is kept in RAM. A
+ * cache miss costs two reads: the index block and the glyph bitmap.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "spiffs_wifi.h"
+#include "unifont.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define UNIFONT_MAGIC    "UFN1"
+#define GLYPH_HEIGHT     16
+#define GLYPH_UNIT       16 /* bytes of a glyph 8 pixels wide */
+#define INDEX_BLOCK      64 /* index entries per block */
+#define REPLACEMENT_CHAR 0xFFFD
+
+/* Private types -------------------------------------------------------------*/
+typedef struct {
+    char     magic[4];
+    uint16_t count; /* glyphs in the index */
+    int8_t   ascent;
+    int8_t   descent;
+} unifont_header_t;
+
+typedef struct {
+    uint16_t codepoint;
+    uint16_t unit : 15; /* bitmap offset, in GLYPH_UNIT */
+    uint16_t wide : 1; /* 16 pixels wide */
+} unifont_entry_t;
+
+typedef struct {
+    uint16_t codepoint;
+    uint8_t  width; /* 0: not in the font */
+    uint32_t last_use;
+    uint8_t  bitmap[2 * GLYPH_UNIT];
+} glyph_slot_t;
+
+/* Locally scoped variables --------------------------------------------------*/
+static const char*      TAG = "UNIFONT";
+static FILE*            s_file = NULL;
+static unifont_header_t s_header;
+static uint16_t*        s_block_first; /* first codepoint of each index block */
+static uint16_t         s_blocks;
+static long             s_bitmaps_pos; /* file position of the bitmaps */
+static glyph_slot_t     s_cache[UNIFONT_CACHE_SIZE];
+static uint32_t         s_clock = 0;
+static unifont_stats_t  s_stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint16_t            utf8_next(const char** str);
+static const glyph_slot_t* get_glyph(uint16_t codepoint);
+static void                load_glyph(glyph_slot_t* slot, uint16_t codepoint);
+static bool                find_entry(uint16_t codepoint, unifont_entry_t* entry);
+static bool                read_at(long pos, void* buf, size_t len);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Open the font file and load the block index. The partition stays
+ * mounted and the file open from now on.
+ *
+ * @retval ESP_ERR_NOT_FOUND if there is no font in the storage partition
+ */
+esp_err_t unifont_init(void)
+{
+    if (spiffs_mount() != ESP_OK)
+        return ESP_FAIL;
+
+    s_file = fopen(UNIFONT_PATH, "rb");
+    if (s_file == NULL) {
+        ESP_LOGW(TAG, "%s not found, only Latin-1 can be displayed", UNIFONT_PATH);
+        spiffs_unmount();
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (fread(&s_header, sizeof(s_header), 1, s_file) != 1
+        || memcmp(s_header.magic, UNIFONT_MAGIC, sizeof(s_header.magic)) != 0) {
+        ESP_LOGE(TAG, "Invalid font file");
+        goto fail;
+    }
+
+    s_blocks = (s_header.count + INDEX_BLOCK - 1) / INDEX_BLOCK;
+    s_block_first = malloc(s_blocks * sizeof(uint16_t));
+    assert(s_block_first && "Error allocating the font index");
+
+    for (uint16_t b = 0; b < s_blocks; b++) {
+        unifont_entry_t entry;
+        long            pos = sizeof(s_header) + (long)b * INDEX_BLOCK * sizeof(entry);
+        if (!read_at(pos, &entry, sizeof(entry)))
+            goto fail;
+        s_block_first[b] = entry.codepoint;
+    }
+    s_bitmaps_pos = sizeof(s_header) + (long)s_header.count * sizeof(unifont_entry_t);
+
+    for (int i = 0; i < UNIFONT_CACHE_SIZE; i++)
+        s_cache[i].last_use = 0; /* free */
+
+    ESP_LOGI(TAG, "%u glyphs, %u index blocks in RAM", s_header.count, s_blocks);
+    return ESP_OK;
+
+fail:
+    free(s_block_first);
+    s_block_first = NULL;
+    fclose(s_file);
+    s_file = NULL;
+    spiffs_unmount();
+    return ESP_FAIL;
+}
+
+/**
+ * @brief Whether str has characters out of Latin-1, that the u8g2 _te fonts
+ * can't show, and the font is available to draw them.
+ *
+ */
+bool unifont_needed(const char* str)
+{
+    if (s_file == NULL)
+        return false;
+    while (*str) {
+        if (utf8_next(&str) > 0xFF)
+            return true;
+    }
+    return false;
+}
+
+int8_t unifont_ascent(void)
+{
+    return s_header.ascent;
+}
+
+int8_t unifont_descent(void)
+{
+    return s_header.descent;
+}
+
+u8g2_uint_t unifont_width(const char* str)
+{
+    u8g2_uint_t width = 0;
+
+    while (*str) {
+        const glyph_slot_t* glyph = get_glyph(utf8_next(&str));
+        width += glyph->width ? glyph->width : 8;
+    }
+    return width;
+}
+
+/**
+ * @brief Draw str with its baseline at y. Characters missing from the font
+ * are drawn as an empty box.
+ *
+ * @return The width of str
+ */
+u8g2_uint_t unifont_draw(u8g2_t* u8g2, u8g2_uint_t x, u8g2_uint_t y, const char* str)
+{
+    u8g2_uint_t start = x;
+    u8g2_uint_t top = y - s_header.ascent;
+
+    while (*str) {
+        const glyph_slot_t* glyph = get_glyph(utf8_next(&str));
+        if (glyph->width) {
+            u8g2_DrawXBM(u8g2, x, top, glyph->width, GLYPH_HEIGHT, glyph->bitmap);
+            x += glyph->width;
+        } else {
+            u8g2_DrawFrame(u8g2, x + 1, top + 2, 6, GLYPH_HEIGHT - 4);
+            x += 8;
+        }
+    }
+    return x - start;
+}
+
+void unifont_stats(unifont_stats_t* stats)
+{
+    *stats = s_stats;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief Decode the next UTF-8 sequence and advance str. Characters out of
+ * the BMP and malformed sequences decode to REPLACEMENT_CHAR.
+ *
+ */
+static uint16_t utf8_next(const char** str)
+{
+    const uint8_t* s = (const uint8_t*)*str;
+    uint32_t       cp;
+    uint8_t        extra;
+
+    if (s[0] < 0x80) {
+        cp = s[0], extra = 0;
+    } else if ((s[0] & 0xE0) == 0xC0) {
+        cp = s[0] & 0x1F, extra = 1;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        cp = s[0] & 0x0F, extra = 2;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        cp = s[0] & 0x07, extra = 3;
+    } else {
+        *str += 1;
+        return REPLACEMENT_CHAR;
+    }
+    for (uint8_t i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) { /* truncated sequence */
+            *str += i;
+            return REPLACEMENT_CHAR;
+        }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    *str += extra + 1;
+    return cp > 0xFFFF ? REPLACEMENT_CHAR : cp;
+}
+
+static const glyph_slot_t* get_glyph(uint16_t codepoint)
+{
+    glyph_slot_t* lru = &s_cache[0];
+
+    s_stats.lookups++;
+    s_clock++;
+    for (int i = 0; i < UNIFONT_CACHE_SIZE; i++) {
+        glyph_slot_t* slot = &s_cache[i];
+        if (slot->last_use && slot->codepoint == codepoint) {
+            s_stats.hits++;
+            slot->last_use = s_clock;
+            return slot;
+        }
+        if (slot->last_use < lru->last_use)
+            lru = slot;
+    }
+    s_stats.misses++;
+    load_glyph(lru, codepoint);
+    lru->last_use = s_clock;
+    return lru;
+}
+
+static void load_glyph(glyph_slot_t* slot, uint16_t codepoint)
+{
+    unifont_entry_t entry;
+
+    slot->codepoint = codepoint;
+    slot->width = 0;
+    if (!find_entry(codepoint, &entry))
+        return;
+
+    size_t len = entry.wide ? 2 * GLYPH_UNIT : GLYPH_UNIT;
+    if (read_at(s_bitmaps_pos + (long)entry.unit * GLYPH_UNIT, slot->bitmap, len))
+        slot->width = entry.wide ? 16 : 8;
+}
+
+/**
+ * @brief Binary search of the index block in RAM, then of the entries of
+ * that block, read from flash.
+ *
+ */
+static bool find_entry(uint16_t codepoint, unifont_entry_t* entry)
+{
+    if (s_blocks == 0 || codepoint < s_block_first[0])
+        return false;
+
+    uint16_t lo = 0, hi = s_blocks - 1;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi + 1) / 2;
+        if (s_block_first[mid] <= codepoint) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    unifont_entry_t block[INDEX_BLOCK];
+    uint16_t        first = lo * INDEX_BLOCK;
+    uint16_t        count = s_header.count - first < INDEX_BLOCK ? s_header.count - first : INDEX_BLOCK;
+    if (!read_at(sizeof(s_header) + (long)first * sizeof(*entry), block, count * sizeof(*entry)))
+        return false;
+
+    int l = 0, r = count - 1;
+    while (l <= r) {
+        int m = (l + r) / 2;
+        if (block[m].codepoint == codepoint) {
+            *entry = block[m];
+            return true;
+        }
+        if (block[m].codepoint < codepoint) {
+            l = m + 1;
+        } else {
+            r = m - 1;
+        }
+    }
+    return false;
+}
+
+static bool read_at(long pos, void* buf, size_t len)
+{
+    s_stats.flash_reads++;
+    if (fseek(s_file, pos, SEEK_SET) != 0 || fread(buf, len, 1, s_file) != 1) {
+        ESP_LOGE(TAG, "Error reading the font file at %ld", pos);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file bench_frames.c
+ * @brief Host time to render the frames of each page. Each page is run for
+ * UPDATES updates, ROUNDS times, and the time per frame flushed is printed.
+ * Only relative numbers mean something: the host is much faster than the
+ * ESP32, but a change that makes a page slower here does so there too.
+ *
+ * usage: bench_frames [rounds]
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "display_flush.h"
+#include "host_pages.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define ROUNDS  100
+#define UPDATES 50 /* frames of an animated page, others stop waiting for input */
+
+/* Private function prototypes -----------------------------------------------*/
+static uint64_t now_ns(void);
+
+/* Exported functions --------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+
+    host_pages_init();
+    printf("%-14s %8s %8s %10s\n", "page", "frames", "updates", "us/frame");
+    for (uint8_t page = 0; page < host_page_count(); page++) {
+        display_flush_stats_t before, after;
+        uint32_t              updates = 0;
+
+        host_page_run(page, UPDATES); /* warm up: caches, first allocations */
+        display_flush_stats(&before);
+        uint64_t start = now_ns();
+        for (int i = 0; i < rounds; i++)
+            updates += host_page_run(page, UPDATES);
+        uint64_t elapsed = now_ns() - start;
+        display_flush_stats(&after);
+
+        uint32_t frames = after.frames - before.frames;
+        printf("%-14s %8u %8u %10.1f\n", host_page_name(page), frames, updates,
+            frames ? elapsed / 1000.0 / frames : 0.0);
+    }
+    return 0;
+}
+
+/* Private functions ---------------------------------------------------------*/
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file host_client.c
+ * @brief The Spotify client and the storage partition as the display uses
+ * them, with fixed data. Lists are answered as soon as they are
+ * asked for, and the track is always the same.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "display.h"
+#include "spiffs_wifi.h"
+#include "spotifyclient.h"
+
+#include "host_client.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define ADD_ITEMS(list, items)                                                         \
+    for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); i++) {                   \
+        strTableAppend(&(list).names, items[i][0], strlen(items[i][0]));                \
+        strTableAppend(&(list).values, items[i][1], strlen(items[i][1]));               \
+    }
+
+/* Locally scoped variables --------------------------------------------------*/
+static const char* SAMPLE_PLAYLISTS[][2] = {
+    { "Discover Weekly", "spotify:playlist:37i9dQZEVXcQ9COmYvdajy" },
+    { "Release Radar", "spotify:playlist:37i9dQZEVXbdINACbjb1qu" },
+    { "Rock en español", "spotify:playlist:37i9dQZF1DX3LyU0mhfqgP" },
+    { "Liked songs from the 80s and 90s, the long list", "spotify:playlist:3cEYpjA9oz9GiPac4AsH4n" },
+    { "Café con leche", "spotify:playlist:1h0CEZCm6IbFTbxThn6Xcs" },
+    { "Focus", "spotify:playlist:37i9dQZF1DWZeKCadgRdKQ" },
+    { "Road trip", "spotify:playlist:37i9dQZF1DX9wC1KY45plY" },
+};
+static const char* SAMPLE_DEVICES[][2] = {
+    { "Living room speaker", "5fbb3ba6aa454b5534c4ba43a8c7e8e45a63ad0e" },
+    { "Pixel 7", "2e5d3c1a9f0b7e46d8c2a1f3b5e7d9c0a2b4c6d8" },
+    { "DESKTOP-F1AB2", "9c8b7a6f5e4d3c2b1a0f9e8d7c6b5a4f3e2d1c0b" },
+};
+static TrackInfo s_track;
+static bool      s_track_ready = false;
+
+/* Globally scoped variables definitions -------------------------------------*/
+TaskHandle_t      PLAYER_TASK = NULL;
+u8g2_items_list_t PLAYLISTS = { 0 };
+u8g2_items_list_t DEVICES = { 0 };
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief The track every test starts with: long enough texts to scroll,
+ * playing at 1:23 of 5:54 on a speaker at 65 % volume.
+ *
+ */
+void host_client_init(void)
+{
+    static char     artists_buf[MAX_ARTISTS * ARTIST_NAME_MAX];
+    static uint16_t artists_offsets[MAX_ARTISTS];
+
+    strTableInitFixed(&s_track.artists, artists_buf, sizeof(artists_buf), artists_offsets, MAX_ARTISTS);
+    s_track.uri = "spotify:track:4u7EnebtmKWzUH433cf5Qv";
+    s_track.name = "Bohemian Rhapsody - Remastered 2011";
+    s_track.album = "A Night At The Opera (2011 Remaster)";
+    strTableAppend(&s_track.artists, "Queen", strlen("Queen"));
+    s_track.duration_ms = 354320;
+    s_track.progress_ms = 83000;
+    s_track.isPlaying = true;
+    s_track.device.id = (char*)SAMPLE_DEVICES[0][1];
+    s_track.device.name = (char*)SAMPLE_DEVICES[0][0];
+    s_track.device.type = "Speaker";
+    strcpy(s_track.device.volume_percent, "65");
+    s_track_ready = true;
+}
+
+/**
+ * @brief Post the event the player task posts when the track is first read.
+ *
+ */
+void host_client_post_track(void)
+{
+    display_post(&(display_event_t) {
+        .type = TRACK_UPDATED,
+        .track = {
+            .changes = TRACK_CHANGED_ALL,
+            .progress_ms = s_track.progress_ms,
+            .duration_ms = s_track.duration_ms,
+            .is_playing = s_track.isPlaying,
+            .volume_percent = atoi(s_track.device.volume_percent),
+        },
+    });
+}
+
+const TrackInfo* track_read_begin(uint32_t* seq)
+{
+    assert(s_track_ready && "host_client_init() not called");
+    *seq = 0;
+    return &s_track;
+}
+
+bool track_read_retry(uint32_t seq)
+{
+    return false;
+}
+
+void player_cmd(Player_cmd_t cmd)
+{
+}
+
+void http_user_playlists_async(uint32_t generation)
+{
+    strTableClear(&PLAYLISTS.names);
+    strTableClear(&PLAYLISTS.values);
+    ADD_ITEMS(PLAYLISTS, SAMPLE_PLAYLISTS);
+    NOTIFY_DISPLAY_LIST(PLAYLISTS_OK, generation);
+}
+
+void http_available_devices_async(uint32_t generation)
+{
+    strTableClear(&DEVICES.names);
+    strTableClear(&DEVICES.values);
+    ADD_ITEMS(DEVICES, SAMPLE_DEVICES);
+    NOTIFY_DISPLAY_LIST(ACTIVE_DEVICES_FOUND, generation);
+}
+
+void http_cancel_background()
+{
+}
+
+void http_play_context_uri(const char* uri, int uri_len)
+{
+}
+
+void http_update_volume_async(uint8_t volume_percent)
+{
+}
+
+bool http_volume_pending()
+{
+    return false;
+}
+
+void http_set_device(const char* dev_id, int id_len)
+{
+    NOTIFY_DISPLAY(PLAYBACK_TRANSFERRED_OK);
+}
+
+esp_err_t spiffs_mount()
+{
+    return ESP_FAIL; /* no font file, Latin-1 only */
+}
+
+void spiffs_unmount()
+{
+}
+
+int wifi_config_delete()
+{
+    return ESP_OK;
+}
@@ -0,0 +1,19 @@
+/**
+ * @file host_client.h
+ * @brief Stand-in for the Spotify client on the host, see host_client.c.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Exported functions prototypes ---------------------------------------------*/
+void host_client_init(void);
+void host_client_post_track(void);
+
+#ifdef __cplusplus
+}
+#endif
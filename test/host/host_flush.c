@@ -0,0 +1,98 @@
+/**
+ * @file host_flush.c
+ * @brief display_flush on the host: frames are composed with the overlay
+ * like on the board, and kept in memory instead of being sent.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <assert.h>
+#include <string.h>
+
+#include "display_flush.h"
+#include "overlay.h"
+
+#include "host_flush.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define FRAME_BUFFER_SIZE (128 * 64 / 8)
+
+/* Locally scoped variables --------------------------------------------------*/
+static u8x8_msg_cb           s_byte_cb;
+static uint8_t               s_page[FRAME_BUFFER_SIZE]; /* last frame flushed, without overlay */
+static size_t                s_page_size = 0;
+static uint8_t               s_frame[FRAME_BUFFER_SIZE]; /* what the display would show */
+static u8g2_t                s_compose_u8g2; /* copy of the display's u8g2, drawing on s_frame */
+static display_flush_stats_t s_stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static void compose(void);
+
+/* Exported functions --------------------------------------------------------*/
+void display_flush_init(u8x8_msg_cb byte_cb)
+{
+    s_byte_cb = byte_cb;
+}
+
+void display_flush(u8g2_t* u8g2)
+{
+    size_t size = (size_t)u8g2_GetBufferTileWidth(u8g2) * 8 * u8g2_GetBufferTileHeight(u8g2);
+
+    assert((size <= FRAME_BUFFER_SIZE) && "Frame buffer bigger than the frame");
+    if (s_compose_u8g2.tile_buf_ptr == NULL)
+        s_compose_u8g2 = *u8g2;
+    memcpy(s_page, u8g2_GetBufferPtr(u8g2), size);
+    s_page_size = size;
+    compose();
+}
+
+void display_flush_refresh(void)
+{
+    if (s_page_size > 0)
+        compose();
+}
+
+/* there is no flush task, timer callbacks run on the only thread */
+void display_flush_request_refresh(void)
+{
+    display_flush_refresh();
+}
+
+void display_flush_invalidate(void)
+{
+}
+
+void display_flush_stats(display_flush_stats_t* stats)
+{
+    *stats = s_stats;
+}
+
+uint8_t display_flush_byte_cb(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr)
+{
+    return s_byte_cb(u8x8, msg, arg_int, arg_ptr);
+}
+
+/**
+ * @brief The last frame composed, in the ST7920 buffer layout: rows of
+ * pixels, MSB first, 1 is black. NULL before the first flush.
+ *
+ */
+const uint8_t* host_flush_frame(uint16_t* width, uint16_t* height)
+{
+    if (s_page_size == 0)
+        return NULL;
+    *width = s_compose_u8g2.width;
+    *height = s_compose_u8g2.height;
+    return s_frame;
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void compose(void)
+{
+    memcpy(s_frame, s_page, s_page_size);
+    s_compose_u8g2.tile_buf_ptr = s_frame;
+    overlay_draw(&s_compose_u8g2);
+    s_stats.frames++;
+    for (size_t i = 0; i < s_page_size; i++)
+        s_stats.pixels_drawn += __builtin_popcount(s_frame[i]);
+}
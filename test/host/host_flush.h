@@ -0,0 +1,21 @@
+/**
+ * @file host_flush.h
+ * @brief Memory backend of display_flush for the host build.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported functions prototypes ---------------------------------------------*/
+const uint8_t* host_flush_frame(uint16_t* width, uint16_t* height);
+
+#ifdef __cplusplus
+}
+#endif
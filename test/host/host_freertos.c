@@ -0,0 +1,300 @@
+/**
+ * @file host_freertos.c
+ * @brief Queues, queue sets, timers and the tick count of FreeRTOS, and a
+ * restart that does nothing, enough to run the display task's code on the
+ * host. Nothing runs concurrently:
+ * tasks are created but never started, and locks always succeed.
+ *
+ * A queue set holds one entry per item sent to its members, like the real
+ * one, so the display code consumes the set the same way on both.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "host_freertos.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define MAX_TIMERS 8
+
+/* Private types -------------------------------------------------------------*/
+struct queue {
+    uint8_t*      items;
+    UBaseType_t   item_size;
+    UBaseType_t   length;
+    UBaseType_t   head;
+    UBaseType_t   count;
+    struct queue* set; /* set the queue belongs to, or NULL */
+};
+
+struct task {
+    const char* name;
+};
+
+struct timer {
+    TimerCallbackFunction_t cb;
+    TickType_t              period;
+    TickType_t              expiry;
+    bool                    reload;
+    bool                    active;
+};
+
+/* Locally scoped variables --------------------------------------------------*/
+static TickType_t   s_ticks = 0;
+static jmp_buf*     s_block_env = NULL;
+static struct timer s_timers[MAX_TIMERS];
+static size_t       s_timer_count = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+static void       block(const char* what);
+static void       wait(TickType_t ticks, const char* what);
+static void       push(struct queue* queue, const void* item);
+static void       pop(struct queue* queue, void* item);
+static BaseType_t set_timer(struct timer* timer, TickType_t period);
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief Where a wait that can't end jumps to, with longjmp(env, 1). The
+ * caller renders a page until it waits for input, which never comes. NULL
+ * makes such a wait abort.
+ *
+ */
+void host_on_block(jmp_buf* env)
+{
+    s_block_env = env;
+}
+
+/**
+ * @brief Let ticks elapse, firing the timers in order of expiry.
+ *
+ */
+void host_advance(TickType_t ticks)
+{
+    TickType_t end = s_ticks + ticks;
+
+    while (1) {
+        struct timer* next = NULL;
+        for (size_t i = 0; i < s_timer_count; i++) {
+            struct timer* timer = &s_timers[i];
+            if (timer->active && (int32_t)(end - timer->expiry) >= 0
+                && (next == NULL || (int32_t)(next->expiry - timer->expiry) > 0))
+                next = timer;
+        }
+        if (next == NULL)
+            break;
+        s_ticks = next->expiry;
+        next->active = next->reload;
+        next->expiry += next->period;
+        next->cb(next);
+    }
+    s_ticks = end;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return s_ticks;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    host_advance(ticks);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void esp_restart(void)
+{
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle)
+{
+    struct task* task = calloc(1, sizeof(*task));
+
+    assert(task && "Error allocating the task");
+    task->name = name;
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return 0;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    wait(ticks, "a task notification");
+    return 0;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct queue* queue = calloc(1, sizeof(*queue));
+
+    assert(queue && "Error allocating the queue");
+    queue->items = calloc(length, item_size);
+    assert(queue->items && "Error allocating the queue");
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks)
+{
+    if (queue->count == queue->length) {
+        wait(ticks, "room in a queue");
+        return pdFALSE;
+    }
+    push(queue, item);
+    if (queue->set)
+        push(queue->set, &queue);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks)
+{
+    if (queue->count == 0) {
+        wait(ticks, "a queue item");
+        return pdFALSE;
+    }
+    pop(queue, item);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    return queue->length - queue->count;
+}
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t length)
+{
+    return xQueueCreate(length, sizeof(QueueSetMemberHandle_t));
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set)
+{
+    if (member->set || member->count)
+        return pdFAIL;
+    member->set = set;
+    return pdPASS;
+}
+
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks)
+{
+    QueueSetMemberHandle_t member;
+
+    if (set->count == 0) {
+        wait(ticks, "a queue set member");
+        return NULL;
+    }
+    pop(set, &member);
+    return member;
+}
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t reload, void* id,
+    TimerCallbackFunction_t cb)
+{
+    assert(s_timer_count < MAX_TIMERS && "Too many timers");
+    struct timer* timer = &s_timers[s_timer_count++];
+    *timer = (struct timer) { .cb = cb, .period = period, .reload = reload };
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks)
+{
+    return set_timer(timer, timer->period);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks)
+{
+    timer->active = false;
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks)
+{
+    return set_timer(timer, period);
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void block(const char* what)
+{
+    if (s_block_env)
+        longjmp(*s_block_env, 1);
+    fprintf(stderr, "Waiting forever for %s, nothing else runs on the host\n", what);
+    abort();
+}
+
+/**
+ * @brief Nothing can arrive while waiting, the wait just times out.
+ *
+ */
+static void wait(TickType_t ticks, const char* what)
+{
+    if (ticks == portMAX_DELAY)
+        block(what);
+    host_advance(ticks);
+}
+
+static void push(struct queue* queue, const void* item)
+{
+    assert(queue->count < queue->length && "Queue set full");
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+}
+
+static void pop(struct queue* queue, void* item)
+{
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+}
+
+static BaseType_t set_timer(struct timer* timer, TickType_t period)
+{
+    timer->period = period;
+    timer->expiry = s_ticks + period;
+    timer->active = true;
+    return pdPASS;
+}
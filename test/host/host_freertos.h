@@ -0,0 +1,27 @@
+/**
+ * @file host_freertos.h
+ * @brief FreeRTOS as the display code sees it, on a single host thread. Time
+ * is simulated: a wait that times out advances the tick count by its timeout
+ * at once, firing the software timers due meanwhile. A wait that could only
+ * end by another task's doing ends the run instead, see host_on_block().
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <setjmp.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* Exported functions prototypes ---------------------------------------------*/
+void host_on_block(jmp_buf* env);
+void host_advance(TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
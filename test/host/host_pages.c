@@ -0,0 +1,91 @@
+/**
+ * @file host_pages.c
+ * @brief The display task on the host. display.c is built into this file,
+ * so its pages can be run one at a time, without the task loop.
+ *
+ * A page runs until its update returns another page, it was updated as many
+ * times as asked, or it waits for input, which on the host never comes.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <setjmp.h>
+
+#include "display.c"
+
+#include "host_client.h"
+#include "host_freertos.h"
+#include "host_pages.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define ENCODER_QUEUE_LEN 16
+
+/* Private function prototypes -----------------------------------------------*/
+static void reset(void);
+
+/* Exported functions --------------------------------------------------------*/
+void host_pages_init(void)
+{
+    QueueHandle_t encoder_queue = xQueueCreate(ENCODER_QUEUE_LEN, sizeof(rotary_encoder_event_t));
+
+    host_client_init();
+    display_init(0, encoder_queue); /* the task is created, never started */
+    setup_display();
+}
+
+uint8_t host_page_count(void)
+{
+    return PAGE_COUNT;
+}
+
+const char* host_page_name(uint8_t page)
+{
+    return PAGES[page].name;
+}
+
+/**
+ * @brief Enter the page, update it up to updates times and exit it. Every
+ * page starts the same, whatever ran before: no overlay, no lists cached and
+ * no events queued but the current track.
+ *
+ * @return The updates done
+ */
+uint32_t host_page_run(uint8_t page, uint32_t updates)
+{
+    jmp_buf           blocked;
+    volatile uint32_t done = 0;
+
+    reset();
+    host_client_post_track();
+    if (setjmp(blocked) == 0) {
+        host_on_block(&blocked);
+        if (PAGES[page].enter)
+            PAGES[page].enter();
+        while (done < updates) {
+            done++;
+            if (PAGES[page].update() != PAGE_STAY)
+                break;
+        }
+    }
+    host_on_block(NULL);
+    if (PAGES[page].exit)
+        PAGES[page].exit();
+    return done;
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void reset(void)
+{
+    display_event_t event;
+    input_event_t   input;
+
+    while (read_client_event(&event, 0))
+        ;
+    while (input_read(&s_input, &input, 0))
+        ;
+    for (size_t i = 0; i < sizeof(LIST_CACHES) / sizeof(LIST_CACHES[0]); i++) {
+        list_cache_drop(LIST_CACHES[i]);
+        LIST_CACHES[i]->state = CACHE_EMPTY;
+    }
+    overlay_hide();
+}
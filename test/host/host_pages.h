@@ -0,0 +1,25 @@
+/**
+ * @file host_pages.h
+ * @brief Runs the pages of the display on the host, one at a time, with the
+ * data of host_client.c.
+ *
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported functions prototypes ---------------------------------------------*/
+void        host_pages_init(void);
+uint8_t     host_page_count(void);
+const char* host_page_name(uint8_t page);
+uint32_t    host_page_run(uint8_t page, uint32_t updates);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <assert.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK            0
+#define ESP_FAIL          -1
+#define ESP_ERR_NO_MEM    0x101
+#define ESP_ERR_NOT_FOUND 0x105
+
+#define ESP_ERROR_CHECK(x) assert((x) == ESP_OK)
@@ -0,0 +1,5 @@
+#pragma once
+
+/* only the types named by the client headers */
+typedef struct esp_http_client* esp_http_client_handle_t;
+typedef struct esp_http_client_event esp_http_client_event_t;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "esp_err.h"
+
+/* only warnings and errors are printed, the test output stays readable */
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG_QUIET(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG_QUIET(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) HOST_LOG_QUIET(tag, fmt, ##__VA_ARGS__)
+
+#define HOST_LOG_QUIET(tag, fmt, ...)                  \
+    do {                                               \
+        if (0)                                         \
+            printf("%s: " fmt, tag, ##__VA_ARGS__);    \
+    } while (0)
@@ -0,0 +1,5 @@
+#pragma once
+
+typedef union {
+    int dummy;
+} wifi_config_t;
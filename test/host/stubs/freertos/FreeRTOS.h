@@ -0,0 +1,51 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host stand-in for the FreeRTOS headers. There is a single thread and
+ * a simulated tick count, see host_freertos.c.
+ *
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+/* included by the IDF headers, the sources count on them */
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+
+typedef uint32_t      TickType_t;
+typedef int           BaseType_t;
+typedef unsigned int  UBaseType_t;
+typedef struct queue* QueueHandle_t;
+typedef struct queue* QueueSetHandle_t;
+typedef struct queue* QueueSetMemberHandle_t;
+typedef struct queue* SemaphoreHandle_t;
+typedef struct task*  TaskHandle_t;
+typedef struct timer* TimerHandle_t;
+
+typedef struct {
+    int dummy;
+} StaticSemaphore_t;
+
+typedef struct {
+    int dummy;
+} portMUX_TYPE;
+
+#define configTICK_RATE_HZ 100 /* CONFIG_FREERTOS_HZ of the firmware */
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY      ((TickType_t)0xffffffffUL)
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux)  ((void)(mux))
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(t)  ((TickType_t)(((uint64_t)(t) * 1000) / configTICK_RATE_HZ))
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdFAIL  0
+#define pdPASS  1
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+QueueHandle_t          xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t             xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t             xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+UBaseType_t            uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t            uxQueueSpacesAvailable(QueueHandle_t queue);
+QueueSetHandle_t       xQueueCreateSet(UBaseType_t length);
+BaseType_t             xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set);
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks);
+
+#define xQueueSendToBack xQueueSend
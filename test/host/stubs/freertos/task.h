@@ -0,0 +1,23 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+
+typedef enum {
+    eNoAction,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite,
+} eNotifyAction;
+
+BaseType_t  xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+     UBaseType_t priority, TaskHandle_t* handle);
+TickType_t  xTaskGetTickCount(void);
+void        vTaskDelay(TickType_t ticks);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+BaseType_t  xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t  xTaskNotifyGive(TaskHandle_t task);
+uint32_t    ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
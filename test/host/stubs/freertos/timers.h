@@ -0,0 +1,11 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t reload, void* id,
+    TimerCallbackFunction_t cb);
+BaseType_t    xTimerStart(TimerHandle_t timer, TickType_t ticks);
+BaseType_t    xTimerStop(TimerHandle_t timer, TickType_t ticks);
+BaseType_t    xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks);
@@ -0,0 +1,34 @@
+#pragma once
+
+/* the types of components/esp32-rotary-encoder the display reads */
+#include <stdint.h>
+
+typedef enum {
+    ROTARY_ENCODER_DIRECTION_NOT_SET,
+    ROTARY_ENCODER_DIRECTION_CLOCKWISE,
+    ROTARY_ENCODER_DIRECTION_COUNTER_CLOCKWISE,
+} rotary_encoder_direction_t;
+
+typedef struct {
+    int32_t                    position;
+    rotary_encoder_direction_t direction;
+} rotary_encoder_state_t;
+
+typedef enum {
+    SHORT_PRESS,
+    MEDIUM_PRESS,
+    LONG_PRESS,
+} button_event_t;
+
+typedef enum {
+    ROTARY_ENCODER_EVENT,
+    BUTTON_EVENT,
+} event_type_t;
+
+typedef struct {
+    event_type_t event_type;
+    union {
+        rotary_encoder_state_t re_state;
+        button_event_t         btn_event;
+    };
+} rotary_encoder_event_t;
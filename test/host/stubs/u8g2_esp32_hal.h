@@ -0,0 +1,4 @@
+#pragma once
+
+/* the host build has no LCD, the display is set up with DISPLAY_HEADLESS */
+#include "u8g2.h"
@@ -0,0 +1,160 @@
+/**
+ * @file test_frames.c
+ * @brief Renders every page and compares the frame with its golden image,
+ * golden/<page>.pbm. A frame that differs is written next to the binary as
+ * <page>.actual.pbm.
+ *
+ * usage: test_frames golden_dir [--update]
+ *
+ * --update writes the frames as the new golden images, to be reviewed
+ * before committing them.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_flush.h"
+#include "host_pages.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define PATH_MAX_LEN 512
+#define MAX_PIXELS   (128 * 64)
+
+/* Private function prototypes -----------------------------------------------*/
+static void     file_name(char* out, size_t size, const char* dir, const char* page, const char* ext);
+static bool     write_pbm(const char* path, const char* page, const uint8_t* frame, uint16_t width, uint16_t height);
+static bool     read_pbm(const char* path, uint8_t* pixels, uint16_t width, uint16_t height);
+static uint32_t compare(const uint8_t* frame, const uint8_t* pixels, uint16_t width, uint16_t height);
+
+/* Exported functions --------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s golden_dir [--update]\n", argv[0]);
+        return 2;
+    }
+    const char* golden_dir = argv[1];
+    bool        update = argc > 2 && strcmp(argv[2], "--update") == 0;
+    int         failed = 0;
+
+    host_pages_init();
+    for (uint8_t page = 0; page < host_page_count(); page++) {
+        const char* name = host_page_name(page);
+        char        path[PATH_MAX_LEN];
+        uint16_t    width, height;
+        uint8_t     pixels[MAX_PIXELS];
+
+        host_page_run(page, 1);
+        const uint8_t* frame = host_flush_frame(&width, &height);
+        if (frame == NULL) {
+            printf("FAIL %s: nothing drawn\n", name);
+            failed++;
+            continue;
+        }
+
+        file_name(path, sizeof(path), golden_dir, name, ".pbm");
+        if (update) {
+            if (write_pbm(path, name, frame, width, height)) {
+                printf("wrote %s\n", path);
+            } else {
+                failed++;
+            }
+            continue;
+        }
+        if (!read_pbm(path, pixels, width, height)) {
+            printf("FAIL %s: no golden image %s, run with --update\n", name, path);
+            failed++;
+            continue;
+        }
+        uint32_t differ = compare(frame, pixels, width, height);
+        if (differ) {
+            file_name(path, sizeof(path), ".", name, ".actual.pbm");
+            write_pbm(path, name, frame, width, height);
+            printf("FAIL %s: %u pixels differ, see %s\n", name, differ, path);
+            failed++;
+        } else {
+            printf("ok   %s\n", name);
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/* page names have spaces, file names get underscores */
+static void file_name(char* out, size_t size, const char* dir, const char* page, const char* ext)
+{
+    int len = snprintf(out, size, "%s/", dir);
+
+    for (const char* c = page; *c && len < (int)size - 1; c++)
+        out[len++] = *c == ' ' ? '_' : *c;
+    snprintf(out + len, size - len, "%s", ext);
+}
+
+/**
+ * @brief Plain PBM, one text row per pixel row, so a change to a golden
+ * image can be reviewed in the diff. The frame has the ST7920 buffer
+ * layout, already the PBM one: rows of pixels, MSB first, 1 is black.
+ *
+ */
+static bool write_pbm(const char* path, const char* page, const uint8_t* frame, uint16_t width, uint16_t height)
+{
+    FILE* out = fopen(path, "w");
+
+    if (out == NULL) {
+        perror(path);
+        return false;
+    }
+    fprintf(out, "P1\n# %s\n%u %u\n", page, width, height);
+    for (uint16_t y = 0; y < height; y++) {
+        for (uint16_t x = 0; x < width; x++)
+            fputc(frame[(y * width + x) / 8] & (0x80 >> (x & 7)) ? '1' : '0', out);
+        fputc('\n', out);
+    }
+    return fclose(out) == 0;
+}
+
+/**
+ * @brief Read a plain PBM of the given size, one byte per pixel.
+ *
+ * @retval false if missing, malformed or of another size
+ */
+static bool read_pbm(const char* path, uint8_t* pixels, uint16_t width, uint16_t height)
+{
+    FILE*    in = fopen(path, "r");
+    char     line[PATH_MAX_LEN];
+    unsigned w = 0, h = 0;
+    int      c;
+
+    if (in == NULL)
+        return false;
+    bool ok = fgets(line, sizeof(line), in) && strncmp(line, "P1", 2) == 0;
+    while (ok && (c = fgetc(in)) == '#') /* comments */
+        ok = fgets(line, sizeof(line), in) != NULL;
+    if (ok) {
+        ungetc(c, in);
+        ok = fscanf(in, "%u %u", &w, &h) == 2 && w == width && h == height;
+    }
+    for (uint32_t i = 0; ok && i < (uint32_t)width * height; i++) {
+        do {
+            c = fgetc(in);
+        } while (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+        ok = c == '0' || c == '1';
+        pixels[i] = c == '1';
+    }
+    fclose(in);
+    return ok;
+}
+
+static uint32_t compare(const uint8_t* frame, const uint8_t* pixels, uint16_t width, uint16_t height)
+{
+    uint32_t differ = 0;
+
+    for (uint32_t i = 0; i < (uint32_t)width * height; i++)
+        differ += !!(frame[i / 8] & (0x80 >> (i & 7))) != pixels[i];
+    return differ;
+}
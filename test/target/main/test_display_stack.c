@@ -0,0 +1,174 @@
+/**
+ * @file test_display_stack.c
+ * @brief Every page of the display runs once on a task with the stack of the
+ * display task, which must keep STACK_MARGIN bytes unused. So must the flush
+ * task, which composes the frames and the overlay of every page. display.c
+ * is built into this file, like in test/host, so its pages can be run one at
+ * a time.
+ *
+ * A page gets the current track and a toast, drawn by the flush task, then
+ * a short press after INPUT_DELAY_MS, which ends the menus and lists. Its
+ * task is deleted once the page exits, or after PAGE_TIMEOUT_MS if it
+ * doesn't.
+ *
+ * The high water marks of every page are printed before anything is
+ * asserted, with the DISPLAY_TASK_STACK they call for.
+ *
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+
+#include "unity.h"
+
+#include "display.c"
+
+#include "host_client.h"
+
+/* Private macro -------------------------------------------------------------*/
+#define STACK_MARGIN      512
+#define STACK_ROUND       256 /* stack sizes are rounded up to it */
+#define ENCODER_QUEUE_LEN 16
+#define INPUT_DELAY_MS    1000
+#define PAGE_TIMEOUT_MS   30000
+
+/* Locally scoped variables --------------------------------------------------*/
+static TaskHandle_t  s_test_task;
+static QueueHandle_t s_encoder_queue;
+
+/* Private function prototypes -----------------------------------------------*/
+static void setup(void);
+static void reset(void);
+static void page_task(void* arg);
+static void player_task(void* arg);
+static void page_done(void) __attribute__((noreturn));
+
+/* Exported functions --------------------------------------------------------*/
+TEST_CASE("every page leaves a margin of the display task's stack", "[display]")
+{
+    static char message[64];
+    UBaseType_t unused[PAGE_COUNT];
+    UBaseType_t flush_unused[PAGE_COUNT];
+    UBaseType_t deepest = DISPLAY_TASK_STACK;
+
+    setup();
+    for (page_id_t page = 0; page < PAGE_COUNT; page++) {
+        reset();
+        host_client_post_track();
+        overlay_show_text("Playback transferred to device", TOAST_MS);
+        int res = xTaskCreate(page_task, "page_task", DISPLAY_TASK_STACK, (void*)(intptr_t)page,
+            uxTaskPriorityGet(NULL), &DISPLAY_TASK);
+        TEST_ASSERT_EQUAL(pdPASS, res);
+
+        vTaskDelay(pdMS_TO_TICKS(INPUT_DELAY_MS));
+        rotary_encoder_event_t press = { .event_type = BUTTON_EVENT, .btn_event = SHORT_PRESS };
+        xQueueSend(s_encoder_queue, &press, 0);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PAGE_TIMEOUT_MS - INPUT_DELAY_MS));
+
+        unused[page] = uxTaskGetStackHighWaterMark(DISPLAY_TASK);
+        vTaskDelete(DISPLAY_TASK);
+        DISPLAY_TASK = NULL;
+        display_flush_stats_t flush;
+        display_flush_stats(&flush);
+        flush_unused[page] = flush.stack_unused;
+        if (unused[page] < deepest)
+            deepest = unused[page];
+    }
+
+    /* every mark first, the stack sizes are set from them */
+    printf("%-16s %8s %8s (bytes never used)\n", "page", "display", "flush");
+    for (page_id_t page = 0; page < PAGE_COUNT; page++)
+        printf("%-16s %8u %8u\n", PAGES[page].name, unused[page], flush_unused[page]);
+    printf("deepest page uses %u of %u bytes, DISPLAY_TASK_STACK for a %u bytes margin: %u\n",
+        DISPLAY_TASK_STACK - deepest, DISPLAY_TASK_STACK, STACK_MARGIN,
+        (DISPLAY_TASK_STACK - deepest + STACK_MARGIN + STACK_ROUND - 1) / STACK_ROUND * STACK_ROUND);
+
+    for (page_id_t page = 0; page < PAGE_COUNT; page++) {
+        snprintf(message, sizeof(message), "display task, %s: %u bytes unused", PAGES[page].name, unused[page]);
+        TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(STACK_MARGIN, unused[page], message);
+        snprintf(message, sizeof(message), "flush task, %s: %u bytes unused", PAGES[page].name, flush_unused[page]);
+        TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(STACK_MARGIN, flush_unused[page], message);
+    }
+}
+
+/**
+ * @brief The restart page ends like the others, without restarting.
+ *
+ */
+void __wrap_esp_restart(void)
+{
+    page_done();
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void setup(void)
+{
+    static bool ready = false;
+
+    s_test_task = xTaskGetCurrentTaskHandle();
+    if (ready)
+        return;
+    s_encoder_queue = xQueueCreate(ENCODER_QUEUE_LEN, sizeof(rotary_encoder_event_t));
+    TEST_ASSERT_NOT_NULL(s_encoder_queue);
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(player_task, "player_task", 2048, NULL, 1, &PLAYER_TASK));
+    host_client_init();
+    events_init(s_encoder_queue);
+    overlay_init();
+    setup_display();
+    ready = true;
+}
+
+/**
+ * @brief Every page starts the same, whatever ran before: no overlay, no
+ * lists cached and no events queued.
+ *
+ */
+static void reset(void)
+{
+    display_event_t event;
+    input_event_t   input;
+
+    while (read_client_event(&event, 0))
+        ;
+    while (input_read(&s_input, &input, 0))
+        ;
+    for (size_t i = 0; i < sizeof(LIST_CACHES) / sizeof(LIST_CACHES[0]); i++) {
+        list_cache_drop(LIST_CACHES[i]);
+        LIST_CACHES[i]->state = CACHE_EMPTY;
+    }
+    overlay_hide();
+}
+
+static void page_task(void* arg)
+{
+    page_id_t page = (page_id_t)(intptr_t)arg;
+
+    if (PAGES[page].enter)
+        PAGES[page].enter();
+    PAGES[page].update();
+    if (PAGES[page].exit)
+        PAGES[page].exit();
+    page_done();
+}
+
+/**
+ * @brief Takes the notifications of the display, like the real player task.
+ *
+ */
+static void player_task(void* arg)
+{
+    while (1)
+        xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+}
+
+/**
+ * @brief Tell the test the page is over and wait to be deleted, so the stack
+ * can still be measured.
+ *
+ */
+static void page_done(void)
+{
+    xTaskNotifyGive(s_test_task);
+    while (1)
+        vTaskSuspend(NULL);
+}
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Convert a GNU Unifont .hex file into the font file read by main/unifont.c.
+
+The whole BMP doesn't fit in the storage partition, so only the given
+codepoint ranges are kept (by default Latin, Greek, Cyrillic, Hebrew, Arabic,
+punctuation, symbols, Hiragana, Katakana, Hangul Jamo and Hangul syllables,
+about 570 KB). CJK ideographs (0x4E00-0x9FFF, 20992 wide glyphs) need more
+index units and flash than there are, even on their own.
+
+usage: unifont_bin.py unifont.hex spiffs_image/unifont.bin [0x0000-0x04FF ...]
+"""
+import struct
+import sys
+
+DEFAULT_RANGES = "0x0020-0x05FF 0x0600-0x06FF 0x2000-0x2BFF 0x3000-0x30FF 0x3130-0x318F 0xAC00-0xD7A3 0xFF00-0xFFFD"
+ASCENT, DESCENT = 14, -2
+GLYPH_UNIT = 16
+MAX_UNITS = 1 << 15
+MAX_SIZE = 0xF0000 * 9 // 10  # leave room for SPIFFS metadata and wifi config
+
+
+def parse_ranges(args):
+    ranges = []
+    for r in args:
+        lo, _, hi = r.partition("-")
+        ranges.append((int(lo, 0), int(hi or lo, 0)))
+    return ranges
+
+
+def xbm_row(bits, width):
+    """Unifont rows are MSB first, XBM rows are LSB first"""
+    out = bytearray()
+    for i in range(width // 8):
+        byte = (bits >> (width - 8 * (i + 1))) & 0xFF
+        out.append(int(f"{byte:08b}"[::-1], 2))
+    return out
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    ranges = parse_ranges(sys.argv[3:] or DEFAULT_RANGES.split())
+
+    glyphs = []
+    with open(sys.argv[1]) as f:
+        for line in f:
+            cp, _, data = line.strip().partition(":")
+            cp = int(cp, 16)
+            if cp > 0xFFFF or not any(lo <= cp <= hi for lo, hi in ranges):
+                continue
+            width = len(data) * 4 // 16  # 32 hex digits: 8 px, 64: 16 px
+            row_len = width // 4
+            bitmap = bytearray()
+            for y in range(16):
+                bitmap += xbm_row(int(data[y * row_len:(y + 1) * row_len], 16), width)
+            glyphs.append((cp, width == 16, bytes(bitmap)))
+
+    glyphs.sort()
+    index, bitmaps, unit = bytearray(), bytearray(), 0
+    for cp, wide, bitmap in glyphs:
+        if unit >= MAX_UNITS:
+            sys.exit("too many glyphs, narrow the ranges")
+        index += struct.pack("<HH", cp, unit | (wide << 15))
+        bitmaps += bitmap
+        unit += len(bitmap) // GLYPH_UNIT
+
+    out = b"UFN1" + struct.pack("<Hbb", len(glyphs), ASCENT, DESCENT) + index + bitmaps
+    if len(out) > MAX_SIZE:
+        sys.exit(f"{len(out)} bytes don't fit in the storage partition, narrow the ranges")
+    with open(sys.argv[2], "wb") as f:
+        f.write(out)
+    print(f"{len(glyphs)} glyphs, {len(out)} bytes")
+
+
+if __name__ == "__main__":
+    main()